@@ -0,0 +1,74 @@
+#ifndef BOOK_FONTMETRICS_H
+#define BOOK_FONTMETRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <gfxfont.h>
+
+// Text measurement straight from an Adafruit GFXfont's glyph table, with no
+// display or canvas: a width is the sum of the glyphs' xAdvance, which is how
+// far print() moves the cursor, and a height the extent of their boxes about
+// the baseline. It holds nothing but the font, so any task can measure while
+// another draws. Characters the font lacks count for nothing, as
+// Adafruit_GFX skips them. One line of text at a time.
+class FontMetrics {
+public:
+  explicit FontMetrics(const GFXfont* font) : font_(font) {}
+
+  const GFXfont* font() const { return font_; }
+
+  // Cursor advance across text[0, len).
+  int advance(const char* text, size_t len) const {
+    int w = 0;
+    for (size_t i = 0; i < len; i++)
+      if (const GFXglyph* g = glyph(text[i])) w += g->xAdvance;
+    return w;
+  }
+
+  int advance(const char* text) const { return advance(text, strlen(text)); }
+
+  // Height of the box around the glyphs of text[0, len), as getTextBounds()
+  // reports it; 0 if none of them draws anything.
+  int height(const char* text, size_t len) const {
+    int w, h;
+    measure(text, len, w, h);
+    return h;
+  }
+
+  int height(const char* text) const { return height(text, strlen(text)); }
+
+  // advance() and height() of text[0, len) in one pass.
+  void measure(const char* text, size_t len, int& width, int& height) const {
+    int  top = 0, bottom = 0;  // rows above and below the baseline
+    bool any = false;
+    width    = 0;
+    for (size_t i = 0; i < len; i++) {
+      const GFXglyph* g = glyph(text[i]);
+      if (!g) continue;
+      width += g->xAdvance;
+      if (g->width == 0 || g->height == 0) continue;
+      int y0 = g->yOffset, y1 = g->yOffset + g->height;
+      if (!any || y0 < top) top = y0;
+      if (!any || y1 > bottom) bottom = y1;
+      any = true;
+    }
+    height = any ? bottom - top : 0;
+  }
+
+  // Baseline to baseline distance the font was designed for.
+  int lineHeight() const { return font_ ? font_->yAdvance : 0; }
+
+private:
+  // Glyph tables are plain flash-mapped arrays on the ESP32; no pgm_read
+  const GFXglyph* glyph(char c) const {
+    uint8_t u = (uint8_t)c;
+    if (!font_ || u < font_->first || u > font_->last) return nullptr;
+    return &font_->glyph[u - font_->first];
+  }
+
+  const GFXfont* font_;
+};
+
+#endif
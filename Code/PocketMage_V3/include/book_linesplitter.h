@@ -0,0 +1,53 @@
+#ifndef BOOK_LINESPLITTER_H
+#define BOOK_LINESPLITTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Splits a buffer holding a stretch of a book into lines without copying or
+// modifying it: lines are (offset, length) views, with the '\n' and a
+// trailing '\r' left out. A line longer than cap - 1 bytes comes back in
+// pieces of that size, so no text is dropped; where it is cut depends only
+// on where the line starts. `whole` says the stretch ends at a line boundary
+// or the end of the file; otherwise a last line without its '\n' may go on
+// past the buffer and is held back.
+class LineSplitter {
+public:
+  LineSplitter(const char* buf, size_t len, size_t cap, bool whole)
+      : buf_(buf), len_(len), maxLine_(cap - 1), whole_(whole) {}
+
+  // Offset of the next unread byte in the buffer.
+  size_t position() const { return pos_; }
+
+  // The next whole line, or false if there is none left in the buffer.
+  bool next(size_t& off, size_t& len) {
+    size_t avail = len_ - pos_;
+    if (avail == 0) return false;
+    const char* nl = (const char*)memchr(buf_ + pos_, '\n', avail < maxLine_ ? avail : maxLine_);
+    size_t      n;
+    if (nl) {
+      n = (size_t)(nl - (buf_ + pos_));
+      off = pos_;
+      pos_ += n + 1;
+    } else if (avail >= maxLine_ || whole_) {  // a buffer-sized piece, or the last line
+      n = avail < maxLine_ ? avail : maxLine_;
+      off = pos_;
+      pos_ += n;
+    } else {
+      return false;
+    }
+    if (n > 0 && buf_[off + n - 1] == '\r') n--;
+    len = n;
+    return true;
+  }
+
+private:
+  const char* buf_;
+  size_t      len_;
+  size_t      maxLine_;
+  bool        whole_;
+  size_t      pos_ = 0;
+};
+
+#endif
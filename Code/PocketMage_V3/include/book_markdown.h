@@ -0,0 +1,71 @@
+#ifndef BOOK_MARKDOWN_H
+#define BOOK_MARKDOWN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Inline Markdown of one source line, split into runs of uniform style in a
+// single left-to-right pass, so the cost is linear in the line's length
+// however many asterisks it has.
+//
+//   *  toggles italic, ** bold, *** both; longer runs of * are literal
+//   `  starts and ends inline code, inside which nothing else is special
+//   \  before ASCII punctuation makes that character literal
+//
+// An emphasis or code span left open runs to the end of the line. Runs point
+// into the line and never include the markers, so an escaped character
+// starts a new run.
+#define RUN_BOLD   0x01
+#define RUN_ITALIC 0x02
+#define RUN_CODE   0x04
+
+inline bool isMarkdownEscapable(char c) {
+  return (c >= '!' && c <= '/') || (c >= ':' && c <= '@') || (c >= '[' && c <= '`') ||
+         (c >= '{' && c <= '~');
+}
+
+// Calls fn(text, len, flags) for each non-empty run of text[0, n), in order.
+template <typename Fn>
+inline void forEachRun(const char* text, size_t n, Fn fn) {
+  uint8_t flags = 0;
+  size_t  start = 0;  // first byte of the open run
+  size_t  i     = 0;
+  auto    flush = [&](size_t end) {
+    if (end > start) fn(text + start, end - start, flags);
+  };
+
+  while (i < n) {
+    char c = text[i];
+    if (flags & RUN_CODE) {
+      if (c == '`') {
+        flush(i);
+        flags &= ~RUN_CODE;
+        start = i + 1;
+      }
+      i++;
+    } else if (c == '\\' && i + 1 < n && isMarkdownEscapable(text[i + 1])) {
+      flush(i);
+      start = i + 1;
+      i += 2;
+    } else if (c == '`') {
+      flush(i);
+      flags |= RUN_CODE;
+      start = ++i;
+    } else if (c == '*') {
+      size_t end = i;
+      while (end < n && text[end] == '*') end++;
+      size_t stars = end - i;
+      if (stars <= 3) {
+        flush(i);
+        flags ^= stars == 1 ? RUN_ITALIC : stars == 2 ? RUN_BOLD : RUN_BOLD | RUN_ITALIC;
+        start = end;
+      }
+      i = end;
+    } else {
+      i++;
+    }
+  }
+  flush(n);
+}
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef BOOK_SEARCH_H
+#define BOOK_SEARCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <book_wordindex.h>
+
+// Boyer-Moore-Horspool substring search, ASCII case-insensitive. scan()
+// streams a whole file through the caller's buffer in large reads and never
+// allocates; the last length()-1 bytes of each block are carried into the
+// next, so a match straddling two reads is still found. Works over anything
+// with fs::File's read/seek (fs::File on the device, an in-memory stream in
+// native tests). With setWordStart() it only takes matches that start a word
+// (isWordByte() before them is false).
+class Horspool {
+public:
+  static const size_t MAX_PATTERN = 32;
+
+  // False if the pattern is empty or longer than MAX_PATTERN.
+  bool setPattern(const char* pattern, size_t len) {
+    if (len == 0 || len > MAX_PATTERN) return false;
+    len_ = len;
+    for (size_t i = 0; i < len; i++) pat_[i] = fold(pattern[i]);
+    for (int c = 0; c < 256; c++) shift_[c] = (uint8_t)len;
+    for (size_t i = 0; i + 1 < len; i++) shift_[pat_[i]] = (uint8_t)(len - 1 - i);
+    return true;
+  }
+
+  size_t length() const { return len_; }
+
+  void setWordStart(bool on) { wordStart_ = on; }
+
+  // First match in text[0, n), or nullptr.
+  const char* find(const char* text, size_t n) const {
+    if (len_ == 0 || n < len_) return nullptr;
+    const uint8_t  last = pat_[len_ - 1];
+    const uint8_t* t    = (const uint8_t*)text;
+    for (size_t i = 0; i <= n - len_;) {
+      uint8_t c = fold(t[i + len_ - 1]);
+      if (c == last && matchesAt(t + i)) return text + i;
+      i += shift_[c];
+    }
+    return nullptr;
+  }
+
+  // Scans the stream for non-overlapping matches that start in [start, end);
+  // pass end = UINT32_MAX for the rest of the stream. Stores the offsets of
+  // the first maxHits in hits and returns how many there are in all. buf
+  // must be larger than the pattern.
+  template <typename Stream>
+  int scan(Stream& stream, uint32_t start, uint32_t end, char* buf, size_t cap, uint32_t* hits,
+           int maxHits) const {
+    if (len_ == 0 || cap <= len_ || start >= end) return 0;
+    uint8_t before = 0;  // the byte before buf[0], for setWordStart()
+    if (wordStart_ && start > 0) {
+      if (!stream.seek(start - 1) || stream.read(&before, 1) != 1) return 0;
+    } else if (!stream.seek(start)) {
+      return 0;
+    }
+    uint64_t stop  = (uint64_t)end + len_ - 1;  // a match may run past `end`
+    uint32_t base  = start;                     // stream offset of buf[0]
+    size_t   keep  = 0;
+    int      count = 0;
+    while (base + keep < stop) {
+      size_t want = cap - keep;
+      if (want > stop - (base + keep)) want = (size_t)(stop - (base + keep));
+      size_t got = stream.read((uint8_t*)buf + keep, want);
+      if (got == 0) break;
+      size_t n   = keep + got;
+      size_t pos = 0;
+      while (const char* hit = find(buf + pos, n - pos)) {
+        size_t at = (size_t)(hit - buf);
+        if (base + at >= end) break;
+        if (wordStart_ && isWordByte(at > 0 ? (uint8_t)buf[at - 1] : before)) {
+          pos = at + 1;
+          continue;
+        }
+        if (count < maxHits) hits[count] = base + (uint32_t)at;
+        count++;
+        pos = at + len_;
+      }
+      // Carry over what could still begin a match
+      size_t from = n - (len_ - 1 < n ? len_ - 1 : n);
+      if (from < pos) from = pos;
+      keep = n - from;
+      if (from > 0) before = (uint8_t)buf[from - 1];
+      memmove(buf, buf + from, keep);
+      base += (uint32_t)from;
+    }
+    return count;
+  }
+
+private:
+  static uint8_t fold(uint8_t c) { return (c >= 'A' && c <= 'Z') ? (uint8_t)(c + 32) : c; }
+  static uint8_t fold(char c) { return fold((uint8_t)c); }
+
+  bool matchesAt(const uint8_t* t) const {
+    for (size_t i = 0; i + 1 < len_; i++)
+      if (fold(t[i]) != pat_[i]) return false;
+    return true;
+  }
+
+  uint8_t pat_[MAX_PATTERN];
+  uint8_t shift_[256];
+  size_t  len_       = 0;
+  bool    wordStart_ = false;
+};
+
+// Page showing byte `at` of a book, starting from `page`: the last page that
+// starts at or before the source line holding it. Pages that start inside
+// that line, below its first display line, can still begin past `at`, so
+// while inLine(page) says the page starts inside the line and
+// firstByte(page), the offset of the first word it shows, lies past `at`,
+// the page before is taken.
+template <typename InLine, typename FirstByte>
+inline int pageShowing(uint32_t at, int page, InLine inLine, FirstByte firstByte) {
+  while (page > 0 && inLine(page) && firstByte(page) > at) page--;
+  return page;
+}
+
+#endif
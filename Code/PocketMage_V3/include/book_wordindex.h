@@ -0,0 +1,321 @@
+#ifndef BOOK_WORDINDEX_H
+#define BOOK_WORDINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+
+// Word index for search: each distinct word of a book mapped to the chunks it
+// occurs in, and so is the first WIX_PREFIX_LEN bytes of each word, for a
+// search that ends inside a word. A word is a run of ASCII letters and digits
+// or non-ASCII (UTF-8) bytes, compared case-insensitively through a 32-bit
+// hash.
+//
+// <book>.wix: a WixHeader, WIX_BUCKETS WixBuckets indexed by the top bits of
+// the hash, then the buckets' WixEntries sorted by hash, each group followed
+// by the posting lists of its entries: LEB128 varints of the gaps between
+// ascending chunk numbers. Written with wixWriteBuckets() over any range of
+// buckets at a time, so the builder only ever holds one range in memory.
+#define WIX_MAGIC       0x58574B42  // "BKWX"
+#define WIX_VERSION     2
+#define WIX_BUCKET_BITS 12
+#define WIX_BUCKETS     (1 << WIX_BUCKET_BITS)
+#define WIX_PREFIX_LEN  3  // word start indexed for searches ending mid-word
+
+struct WixHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t headerSize;  // sizeof(WixHeader) when written
+  uint32_t bookSize;    // the .idx stamp this index belongs to
+  uint32_t bookMtime;
+  uint32_t layoutHash;
+  uint32_t chunkCount;
+  uint32_t wordCount;
+  uint32_t reserved;
+};
+
+struct WixBucket {
+  uint32_t entryOff;  // file offset of the bucket's first WixEntry
+  uint32_t count;     // entries in the bucket
+};
+
+struct WixEntry {
+  uint32_t hash;
+  uint32_t postOff;    // file offset of the posting list
+  uint32_t postCount;  // chunks in it
+};
+
+// One occurrence of a word in a chunk, as logged while indexing.
+struct WordPair {
+  uint32_t hash;
+  uint32_t chunk;
+};
+
+static_assert(sizeof(WixHeader) == 32, "WixHeader is stored on SD as-is");
+static_assert(sizeof(WixBucket) == 8, "WixBucket is stored on SD as-is");
+static_assert(sizeof(WixEntry) == 12, "WixEntry is stored on SD as-is");
+static_assert(sizeof(WordPair) == 8, "WordPair is stored on SD as-is");
+
+inline bool isWordByte(uint8_t c) {
+  return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c >= 0x80;
+}
+
+// FNV-1a of the folded word; never 0, which WordSet uses as "empty".
+inline uint32_t wordHash(const char* w, size_t len) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    uint8_t c = (uint8_t)w[i];
+    if (c >= 'A' && c <= 'Z') c += 32;
+    h = (h ^ c) * 16777619u;
+  }
+  return h ? h : 1;
+}
+
+// Hash under which a word is indexed by its first WIX_PREFIX_LEN bytes; a
+// word of exactly that length gets both. It takes a NUL after the bytes, so
+// it never equals the wordHash() of the same word.
+inline uint32_t prefixHash(const char* w) {
+  uint32_t h = wordHash(w, WIX_PREFIX_LEN);
+  h *= 16777619u;
+  return h ? h : 1;
+}
+
+// Calls fn(hash) for every word in text[0, len).
+template <typename Fn>
+inline void forEachWord(const char* text, size_t len, Fn fn) {
+  size_t i = 0;
+  while (i < len) {
+    while (i < len && !isWordByte((uint8_t)text[i])) i++;
+    size_t start = i;
+    while (i < len && isWordByte((uint8_t)text[i])) i++;
+    if (i > start) fn(wordHash(text + start, i - start));
+  }
+}
+
+// Calls fn(hash) for every entry text[0, len) gives the index: each word,
+// and the prefixHash() of each word at least WIX_PREFIX_LEN bytes long.
+template <typename Fn>
+inline void forEachIndexTerm(const char* text, size_t len, Fn fn) {
+  size_t i = 0;
+  while (i < len) {
+    while (i < len && !isWordByte((uint8_t)text[i])) i++;
+    size_t start = i;
+    while (i < len && isWordByte((uint8_t)text[i])) i++;
+    if (i > start) fn(wordHash(text + start, i - start));
+    if (i - start >= WIX_PREFIX_LEN) fn(prefixHash(text + start));
+  }
+}
+
+// True if a match of the query must start a word: it begins with a word
+// byte. Such a match is not taken inside a longer word ("cat" finds "cats"
+// but not "concatenate"), so every word of the query starts a word of the
+// book.
+inline bool queryStartsWord(const char* query, size_t len) {
+  return len > 0 && isWordByte((uint8_t)query[0]);
+}
+
+// Calls fn(hash) for each index entry every match of a search query holds,
+// given that matches start words (queryStartsWord()): the hash of each word
+// the query ends with a separator, and the prefixHash() of a last word that
+// runs to the end of the query, which may go on in the book. A last word
+// shorter than WIX_PREFIX_LEN pins nothing down.
+template <typename Fn>
+inline void forEachQueryTerm(const char* query, size_t len, Fn fn) {
+  size_t i = 0;
+  while (i < len) {
+    while (i < len && !isWordByte((uint8_t)query[i])) i++;
+    size_t start = i;
+    while (i < len && isWordByte((uint8_t)query[i])) i++;
+    if (i > start && i < len) fn(wordHash(query + start, i - start));
+    else if (i - start >= WIX_PREFIX_LEN) fn(prefixHash(query + start));
+  }
+}
+
+inline int wixBucket(uint32_t hash) {
+  return (int)(hash >> (32 - WIX_BUCKET_BITS));
+}
+
+// Distinct word hashes, in an open-addressing table over the caller's
+// `cap` slots (a power of two).
+class WordSet {
+public:
+  WordSet(uint32_t* slots, size_t cap) : slots_(slots), mask_(cap - 1) { clear(); }
+
+  void clear() {
+    memset(slots_, 0, (mask_ + 1) * sizeof(uint32_t));
+    size_ = 0;
+  }
+
+  // True if h was added; false if already present or the table is 3/4 full.
+  bool insert(uint32_t h) {
+    if (size_ >= (mask_ + 1) / 4 * 3) return false;
+    for (size_t i = h & mask_;; i = (i + 1) & mask_) {
+      if (slots_[i] == h) return false;
+      if (slots_[i] == 0) {
+        slots_[i] = h;
+        size_++;
+        return true;
+      }
+    }
+  }
+
+  size_t size() const { return size_; }
+
+  // Calls fn(hash) for every member, in table order.
+  template <typename Fn>
+  void forEach(Fn fn) const {
+    for (size_t i = 0; i <= mask_; i++)
+      if (slots_[i]) fn(slots_[i]);
+  }
+
+private:
+  uint32_t* slots_;
+  size_t    mask_;
+  size_t    size_ = 0;
+};
+
+// Sorts pairs by (hash, chunk) and drops repeats; returns the new count.
+inline size_t sortWordPairs(WordPair* p, size_t n) {
+  std::sort(p, p + n, [](const WordPair& a, const WordPair& b) {
+    return a.hash != b.hash ? a.hash < b.hash : a.chunk < b.chunk;
+  });
+  size_t out = 0;
+  for (size_t i = 0; i < n; i++)
+    if (out == 0 || p[i].hash != p[out - 1].hash || p[i].chunk != p[out - 1].chunk)
+      p[out++] = p[i];
+  return out;
+}
+
+inline size_t varintSize(uint32_t v) {
+  size_t n = 1;
+  while (v >= 0x80) {
+    v >>= 7;
+    n++;
+  }
+  return n;
+}
+
+// Writes the entries and posting lists of buckets [bLo, bHi) at file offset
+// `off`, where out is positioned, and fills dir[bLo, bHi). pairs must be
+// sorted by sortWordPairs() and hold exactly the words of those buckets.
+// Returns the bytes written, or 0 if a write fell short.
+template <typename Out>
+inline uint32_t wixWriteBuckets(Out& out, const WordPair* pairs, size_t n, uint32_t off, int bLo,
+                                int bHi, WixBucket* dir) {
+  uint8_t  buf[256];
+  size_t   used = 0;
+  uint32_t total = 0;
+  bool     ok    = true;
+  auto put = [&](const void* data, size_t len) {
+    if (used + len > sizeof(buf)) {
+      ok = ok && out.write(buf, used) == used;
+      used = 0;
+    }
+    memcpy(buf + used, data, len);
+    used  += len;
+    total += (uint32_t)len;
+  };
+
+  size_t words = 0;
+  for (size_t i = 0; i < n; i++)
+    if (i == 0 || pairs[i].hash != pairs[i - 1].hash) words++;
+
+  for (int b = bLo; b < bHi; b++) dir[b] = {off, 0};
+  uint32_t postOff = off + (uint32_t)(words * sizeof(WixEntry));
+  for (size_t i = 0; i < n;) {
+    WixEntry e = {pairs[i].hash, postOff, 0};
+    uint32_t prev = 0;
+    for (; i < n && pairs[i].hash == e.hash; i++) {
+      postOff += (uint32_t)varintSize(pairs[i].chunk - prev);
+      prev = pairs[i].chunk;
+      e.postCount++;
+    }
+    WixBucket& bucket = dir[wixBucket(e.hash)];
+    if (bucket.count++ == 0) bucket.entryOff = off + total;
+    put(&e, sizeof(e));
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    uint32_t v = (i == 0 || pairs[i].hash != pairs[i - 1].hash) ? pairs[i].chunk
+                                                                 : pairs[i].chunk - pairs[i - 1].chunk;
+    uint8_t  enc[5];
+    size_t   len = 0;
+    while (v >= 0x80) {
+      enc[len++] = (uint8_t)(v | 0x80);
+      v >>= 7;
+    }
+    enc[len++] = (uint8_t)v;
+    put(enc, len);
+  }
+  if (used) ok = ok && out.write(buf, used) == used;
+  return ok ? total : 0;
+}
+
+// Looks hash up in an open .wix; false if the word is not in the book or the
+// file cannot be read.
+template <typename In>
+inline bool wixFind(In& in, uint32_t hash, WixEntry& out) {
+  WixBucket b;
+  if (!in.seek(sizeof(WixHeader) + wixBucket(hash) * sizeof(WixBucket)) ||
+      in.read((uint8_t*)&b, sizeof(b)) != sizeof(b))
+    return false;
+  WixEntry batch[16];
+  for (uint32_t i = 0; i < b.count; i += 16) {
+    uint32_t k = std::min<uint32_t>(16, b.count - i);
+    if (!in.seek(b.entryOff + i * sizeof(WixEntry)) ||
+        in.read((uint8_t*)batch, k * sizeof(WixEntry)) != k * sizeof(WixEntry))
+      return false;
+    for (uint32_t j = 0; j < k; j++) {
+      if (batch[j].hash == hash) {
+        out = batch[j];
+        return true;
+      }
+      if (batch[j].hash > hash) return false;
+    }
+  }
+  return false;
+}
+
+// Decodes one posting list, reading the file in small blocks.
+template <typename In>
+class PostingReader {
+public:
+  PostingReader(In& in, const WixEntry& e) : in_(in), pos_(e.postOff), left_(e.postCount) {}
+
+  // Next chunk in ascending order, or false at the end of the list.
+  bool next(uint32_t& chunk) {
+    if (left_ == 0) return false;
+    uint32_t v = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+      if (head_ == tail_ && !refill()) return false;
+      uint8_t c = buf_[head_++];
+      v |= (uint32_t)(c & 0x7F) << shift;
+      if (!(c & 0x80)) break;
+    }
+    prev_ += v;
+    chunk = prev_;
+    left_--;
+    return true;
+  }
+
+private:
+  bool refill() {
+    if (!in_.seek(pos_)) return false;
+    tail_ = in_.read(buf_, sizeof(buf_));
+    head_ = 0;
+    pos_ += (uint32_t)tail_;
+    return tail_ > 0;
+  }
+
+  In&      in_;
+  uint32_t pos_;
+  uint32_t left_;
+  uint32_t prev_ = 0;
+  uint8_t  buf_[64];
+  size_t   head_ = 0;
+  size_t   tail_ = 0;
+};
+
+#endif
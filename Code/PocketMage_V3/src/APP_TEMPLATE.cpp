@@ -1,14 +1,25 @@
 // Book Reader OTA App — PocketMage
 // Drop .md files into /books/ on the SD card.
 // On launch: select a book with < / >, press Space to open.
-// Reading: < / > to page, FN+< / FN+> to jump chunks, 'b' to return to picker.
+// Reading: < / > to page, FN+< / FN+> to jump chunks, SHIFT+< / SHIFT+> to jump
+// headings, 't' for the table of contents, 'g' to jump to a page or percentage,
+// 's' to find text (n / N step through matches), 'r' to turn the page cache on
+// or off, 'b' to return to picker.
 // ESC saves position and returns to PocketMage OS.
 
 #include <SD_MMC.h>
+#include <book_fontmetrics.h>
+#include <book_linesplitter.h>
+#include <book_markdown.h>
+#include <book_search.h>
+#include <book_wordindex.h>
 #include <globals.h>
 
 #include <Preferences.h>
-#include <vector>
+#include <algorithm>
+#include <climits>
+
+static constexpr const char* TAG = "BOOKS";
 
 // ── Configuration ─────────────────────────────────────────────────────────────
 #define SPECIAL_PADDING      20
@@ -19,16 +30,39 @@
 #define NORMAL_LINE_PADDING  4
 #define LINES_PER_PAGE       12
 #define CONTENT_START_Y      20
-#define LINES_PER_CHUNK      100   // source lines per chunk
-#define MAX_CHUNKS           256   // stack array cap in buildIndex()
-
-#define MAX_WORD_LEN         63    // max chars per word stored in text pool
-#define TEXT_POOL_CAP        10240 // word text bytes for one chunk (~10 KB)
-#define WORD_REF_CAP         4000  // total word references for one chunk
-#define DISPLAY_LINE_CAP     600   // total display lines for one chunk
+#define LINES_PER_CHUNK      400   // most source lines per chunk; a full pool below ends one sooner
+#define CHUNK_PAGE_RECS      64    // chunk records read from the index at a time
+#define CHUNK_CACHE_PAGES    4     // pages of chunk records kept in RAM
+
+#define MAX_WORD_LEN         63    // max chars laid out per word
+#define TEXT_POOL_CAP        20480 // book bytes for one chunk (~20 KB)
+#define WORD_REF_CAP         4000  // total words for one chunk
+#define DISPLAY_LINE_CAP     1000  // total display lines for one chunk
+#define WINDOW_SLOTS         3     // resident chunks: previous, current, next
+
+#define PAGE_VIEW_LINES      (2 * LINES_PER_PAGE)  // display lines laid out for a direct page view
+#define PAGE_VIEW_TEXT_CAP   (2 * LINE_BUF_SIZE)
+#define PAGE_VIEW_WORD_CAP   768
+#define LINE_BUF_SIZE        8192  // longest source line; longer lines are split
+
+#define SEARCH_BUF_SIZE      32768 // read size when scanning the book for a search
+#define SEARCH_MAX_HITS      512   // match offsets kept per search
+#define WORD_SET_SLOTS       16384 // distinct index terms per chunk while indexing, power of two
+#define WIX_MAX_CANDIDATES   1024  // more chunks than this for a query and the whole book is scanned
+#define WIX_PASS_MAX_PAIRS   (256 * 1024)  // word/chunk pairs sorted per .wix build pass (2 MB)
+
+#define RESIDENT_RESERVE     (1024 * 1024) // PSRAM left free when a book is made resident
+#define RESIDENT_LAYOUT_COST 2     // PSRAM for a resident book's layout, per byte of book
+#define RESIDENT_MIN_CHUNK   256   // fewest bytes per chunk, to size the resident table
+
+#define RASTER_AHEAD         8     // pages the page cache renders ahead when idle
+#define RASTER_IDLE_MS       5000  // no key for this long and the device counts as idle
+#define RASTER_RING_PAGES    8     // most recently shown pages kept in RAM
+#define RASTER_RING_RESERVE  (96 * 1024)  // memory left free when sizing that ring
+#define SPECULATE_PREV       1     // besides the next page, pre-draw the one before
 
 // ── App mode ──────────────────────────────────────────────────────────────────
-enum AppMode { MODE_PICKER, MODE_READING, MODE_PAGE_JUMP };
+enum AppMode { MODE_PICKER, MODE_READING, MODE_PAGE_JUMP, MODE_SEARCH, MODE_TOC };
 static AppMode appMode = MODE_PICKER;
 
 // ── Book picker ───────────────────────────────────────────────────────────────
@@ -49,6 +83,14 @@ static const char* const CURRENT_PATH = "/books/.current";
 static char s_bookPath       [96];
 static char s_bmarkPath      [96];
 static char s_idxPath        [96];
+static char s_pgtPath        [96];
+static char s_ickPath        [96];
+static char s_hdgPath        [96];
+static char s_tocPath        [96];
+static char s_wlgPath        [96];
+static char s_wixPath        [96];
+static char s_lycDir         [96];
+static char s_rasPath        [96];
 static char s_bookDisplayName[MAX_BOOK_NAME];
 
 static void setPaths(const char* fname) {
@@ -62,6 +104,14 @@ static void setPaths(const char* fname) {
     base[len - 3] = '\0';
   snprintf(s_bmarkPath, sizeof(s_bmarkPath), "/books/.bmarks/%s.bmark", base);
   snprintf(s_idxPath,   sizeof(s_idxPath),   "/books/.bmarks/%s.idx",   base);
+  snprintf(s_pgtPath,   sizeof(s_pgtPath),   "/books/.bmarks/%s.pgt",   base);
+  snprintf(s_ickPath,   sizeof(s_ickPath),   "/books/.bmarks/%s.ick",   base);
+  snprintf(s_hdgPath,   sizeof(s_hdgPath),   "/books/.bmarks/%s.hdg",   base);
+  snprintf(s_tocPath,   sizeof(s_tocPath),   "/books/.bmarks/%s.toc",   base);
+  snprintf(s_wlgPath,   sizeof(s_wlgPath),   "/books/.bmarks/%s.wlg",   base);
+  snprintf(s_wixPath,   sizeof(s_wixPath),   "/books/.bmarks/%s.wix",   base);
+  snprintf(s_lycDir,    sizeof(s_lycDir),    "/books/.bmarks/%s.lyc",   base);
+  snprintf(s_rasPath,   sizeof(s_rasPath),   "/books/.bmarks/%s.ras",   base);
   strncpy(s_bookDisplayName, base, sizeof(s_bookDisplayName) - 1);
   s_bookDisplayName[sizeof(s_bookDisplayName) - 1] = '\0';
 }
@@ -132,8 +182,9 @@ static void initFonts() {
   s_fonts.list      = &FreeSerif9pt7b;
 }
 
-static const GFXfont* pickFont(char style, bool bold, bool italic) {
+static const GFXfont* pickFont(char style, bool bold, bool italic, bool code = false) {
   FontMap& fm = s_fonts;
+  if (code) return fm.code;
   switch (style) {
     case '1': return bold ? fm.h1_B : fm.h1;
     case '2': return bold ? fm.h2_B : fm.h2;
@@ -150,441 +201,2862 @@ static const GFXfont* pickFont(char style, bool bold, bool italic) {
   }
 }
 
-// ── Layout pools (all static — zero heap in rendering pipeline) ──────────────
-struct WordRef {
-  const char* text;
-  bool        bold;
-  bool        italic;
+// ── Layout pools (allocated once — zero heap in rendering pipeline) ──────────
+// A laid-out chunk is three tables, each kept as parallel arrays so an entry
+// costs only the bytes it uses:
+//
+//   words          a view of the text pool (offset, length) and where it is
+//                  drawn: px from the start of the line, RUN_* flags above
+//   display lines  first word, word count and baseline; a line's number on
+//                  the page is its index
+//   source lines   book offset, first display line, display line count, style
+//
+// The text pool holds the book's bytes as read and positions are fixed at
+// layout time, so drawing a page neither copies nor measures text. List
+// numbers are not stored per line: each run of list lines counts up from 1,
+// or from listStart for a list the layout opens inside (see listNumber()).
+#define WORD_X_MASK     0x1FFF
+#define WORD_FLAG_SHIFT 13
+
+// One laid-out chunk. The pools are allocated once at start; a ChunkLayout only
+// points at them so the same layout code can fill any slot of the window.
+enum SlotState : uint8_t { SLOT_EMPTY, SLOT_LOADING, SLOT_READY };
+
+struct ChunkLayout {
+  char*     textPool;  // the chunk's text, read from the book in one go
+  int       textPoolCap;
+  int       textPoolUsed;
+  uint16_t* wordOff;   // into textPool
+  uint8_t*  wordLen;
+  uint16_t* wordPos;   // x | RUN_* flags << WORD_FLAG_SHIFT
+  int       wordRefsCap;
+  int       wordRefsUsed;
+  uint16_t* lineWordStart;
+  uint8_t*  lineWordCount;
+  uint8_t*  lineBaseline;  // px from the top of the line to its baseline
+  int       displayLinesCap;
+  int       displayLinesUsed;
+  uint32_t* srcOffset;     // byte offset of the line in the book file
+  uint16_t* srcLineStart;
+  uint8_t*  srcLineCount;
+  char*     srcStyle;
+  int       sourceLinesCap;
+  int       sourceLinesUsed;
+  uint16_t  listStart;  // number of a list item the layout opens with
+  bool      overflow;   // a pool filled up; nothing more is committed
+
+  volatile int       chunk;  // chunk held by this slot, -1 = none
+  volatile SlotState state;
 };
 
-struct DisplayLine {
-  ulong    lineIdx;
-  uint16_t wordStart;
-  uint8_t  wordCount;
+// Storage for one ChunkLayout, widest fields first so nothing is padded.
+template <int TEXT, int WORDS, int LINES, int SRCS>
+struct LayoutPools {
+  uint32_t srcOffset[SRCS];
+  uint16_t wordOff[WORDS];
+  uint16_t wordPos[WORDS];
+  uint16_t lineWordStart[LINES];
+  uint16_t srcLineStart[SRCS];
+  uint8_t  wordLen[WORDS];
+  uint8_t  lineWordCount[LINES];
+  uint8_t  lineBaseline[LINES];
+  uint8_t  srcLineCount[SRCS];
+  char     srcStyle[SRCS];
+  char     text[TEXT];
 };
 
-struct SourceLine {
-  char     style;
-  uint16_t lineStart;
-  uint8_t  lineCount;
-  ulong    orderedListNum;
-};
+using ChunkPools = LayoutPools<TEXT_POOL_CAP, WORD_REF_CAP, DISPLAY_LINE_CAP, LINES_PER_CHUNK>;
+
+// Single screen laid out straight from the page table while the full chunk
+// is not resident yet.
+using PageViewPools =
+    LayoutPools<PAGE_VIEW_TEXT_CAP, PAGE_VIEW_WORD_CAP, PAGE_VIEW_LINES, PAGE_VIEW_LINES>;
+
+// The pools come to about 165 KB, so they are allocated once, from PSRAM when
+// there is some, rather than taking that much internal RAM as BSS. Kept
+// across app launches like the task locks.
+static ChunkPools*    s_pools[WINDOW_SLOTS] = {};
+static PageViewPools* s_pvPools             = nullptr;
+
+static void* allocLarge(size_t bytes) {
+  void* p = heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM);
+  return p ? p : heap_caps_malloc(bytes, MALLOC_CAP_8BIT);
+}
+
+// Any source line must fit a chunk's text pool whole, and words and lines
+// are indexed with 16 bits
+static_assert(TEXT_POOL_CAP > LINE_BUF_SIZE, "TEXT_POOL_CAP must exceed LINE_BUF_SIZE");
+static_assert(TEXT_POOL_CAP <= 0xFFFF && PAGE_VIEW_TEXT_CAP <= 0xFFFF, "text offsets are 16-bit");
+static_assert(WORD_REF_CAP <= 0xFFFF && DISPLAY_LINE_CAP <= 0xFFFF, "pool indices are 16-bit");
+
+static ChunkLayout  s_window[WINDOW_SLOTS];
+static ChunkLayout  s_pageView;
+static int          s_pageViewPage   = -1;            // global page held by s_pageView
+static ChunkLayout* s_cur            = &s_window[0];  // layout being displayed
+static ulong        s_pageStartLine  = 0;
+
+static void resetLayout(ChunkLayout& L) {
+  L.textPoolUsed     = 0;
+  L.wordRefsUsed     = 0;
+  L.displayLinesUsed = 0;
+  L.sourceLinesUsed  = 0;
+  L.listStart        = 1;
+  L.overflow         = false;
+}
+
+template <int TEXT, int WORDS, int LINES, int SRCS>
+static void bindLayout(ChunkLayout& L, LayoutPools<TEXT, WORDS, LINES, SRCS>& p) {
+  L.textPool        = p.text;
+  L.textPoolCap     = TEXT;
+  L.wordOff         = p.wordOff;
+  L.wordLen         = p.wordLen;
+  L.wordPos         = p.wordPos;
+  L.wordRefsCap     = WORDS;
+  L.lineWordStart   = p.lineWordStart;
+  L.lineWordCount   = p.lineWordCount;
+  L.lineBaseline    = p.lineBaseline;
+  L.displayLinesCap = LINES;
+  L.srcOffset       = p.srcOffset;
+  L.srcLineStart    = p.srcLineStart;
+  L.srcLineCount    = p.srcLineCount;
+  L.srcStyle        = p.srcStyle;
+  L.sourceLinesCap  = SRCS;
+  L.chunk           = -1;
+  L.state           = SLOT_EMPTY;
+  resetLayout(L);
+}
+
+// Number of the list item at source line si (style 'L').
+static ulong listNumber(const ChunkLayout& L, int si) {
+  int first = si;
+  while (first > 0 && L.srcStyle[first - 1] == 'L') first--;
+  return (first == 0 ? L.listStart : 1) + (ulong)(si - first);
+}
+
+// Returns false if the pools cannot be allocated; a book cannot be read then.
+static bool initWindow() {
+  for (int i = 0; i < WINDOW_SLOTS; i++)
+    if (!s_pools[i]) s_pools[i] = (ChunkPools*)allocLarge(sizeof(ChunkPools));
+  if (!s_pvPools) s_pvPools = (PageViewPools*)allocLarge(sizeof(PageViewPools));
+  for (int i = 0; i < WINDOW_SLOTS; i++)
+    if (!s_pools[i]) return false;
+  if (!s_pvPools) return false;
+
+  for (int i = 0; i < WINDOW_SLOTS; i++) bindLayout(s_window[i], *s_pools[i]);
+  bindLayout(s_pageView, *s_pvPools);
+  s_pageViewPage = -1;
+  s_cur          = &s_window[0];
+  return true;
+}
+
+// ── Resident book ─────────────────────────────────────────────────────────────
+// With enough free PSRAM the whole book is read into it once at start-up and
+// chunks never touch the SD card again: their text is copied from RAM, and
+// once laid out each chunk is kept in PSRAM in pools cut to its size, with
+// its words pointing straight into the book. Turning to a chunk already laid
+// out is then a pointer lookup, with no parsing or measuring. The index task
+// keeps every chunk it lays out, and the prefetch task lays out the rest
+// while the reader is idle. Without PSRAM, or for a book too large, nothing
+// changes: chunks go through the window below.
+static SemaphoreHandle_t s_windowLock  = NULL;     // window slots, resident table entries
+static char*             s_bookText    = nullptr;  // the whole book, when resident
+static uint32_t          s_bookTextLen = 0;
+static ChunkLayout**     s_resident    = nullptr;  // laid-out chunks, by index
+static int               s_residentCap = 0;
+
+// Chunk idx's resident layout, if it has one. Entries are only ever set once.
+static ChunkLayout* residentLayout(int idx) {
+  return (idx >= 0 && idx < s_residentCap) ? s_resident[idx] : nullptr;
+}
+
+// Reads the open book into PSRAM if it fits, along with room for its layout.
+static void loadResidentBook() {
+  if (!psramFound()) return;
+  File f = SD_MMC.open(s_bookPath, FILE_READ);
+  if (!f) return;
+  size_t len   = f.size();
+  size_t avail = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+  if ((uint64_t)len * (1 + RESIDENT_LAYOUT_COST) + RESIDENT_RESERVE > avail) {
+    ESP_LOGI(TAG, "%s (%u bytes) stays on SD: %u bytes of PSRAM free", s_bookDisplayName,
+             (unsigned)len, (unsigned)avail);
+    f.close();
+    return;
+  }
+
+  int    cap   = (int)(len / RESIDENT_MIN_CHUNK) + 2;
+  char*  text  = (char*)heap_caps_malloc(len + 1, MALLOC_CAP_SPIRAM);
+  auto** table = (ChunkLayout**)heap_caps_calloc(cap, sizeof(ChunkLayout*), MALLOC_CAP_SPIRAM);
+  size_t got   = 0;
+  while (text && table && got < len) {
+    size_t n = f.read((uint8_t*)text + got, min(len - got, (size_t)SEARCH_BUF_SIZE));
+    if (n == 0) break;
+    got += n;
+  }
+  f.close();
+  if (!text || !table || got < len) {
+    heap_caps_free(text);
+    heap_caps_free(table);
+    return;
+  }
+
+  s_bookText    = text;
+  s_bookTextLen = (uint32_t)len;
+  s_resident    = table;
+  s_residentCap = cap;
+  ESP_LOGI(TAG, "%s resident in PSRAM (%u bytes)", s_bookDisplayName, (unsigned)len);
+}
+
+template <typename T>
+static T* keepArray(uint8_t*& p, const T* src, int n) {
+  T* dst = (T*)p;
+  memcpy(dst, src, n * sizeof(T));
+  p += n * sizeof(T);
+  return dst;
+}
 
-static char        s_textPool[TEXT_POOL_CAP];
-static int         s_textPoolUsed     = 0;
-static WordRef     s_wordRefs[WORD_REF_CAP];
-static int         s_wordRefsUsed     = 0;
-static DisplayLine s_displayLines[DISPLAY_LINE_CAP];
-static int         s_displayLinesUsed = 0;
-static SourceLine  s_sourceLines[LINES_PER_CHUNK];
-static int         s_sourceLinesUsed  = 0;
-static ulong       s_lineIndex        = 0;
-static ulong       s_pageStartLine    = 0;
+// Keeps chunk idx, laid out in L, as its resident layout and returns it; null
+// if the book is not resident or PSRAM ran out. L itself can then be reused.
+static ChunkLayout* keepResident(const ChunkLayout& L, int idx) {
+  if (!s_bookText || idx < 0 || idx >= s_residentCap) return nullptr;
+  if (ChunkLayout* R = residentLayout(idx)) return R;
+
+  // Words point into the book unless L holds other text (the empty placeholder)
+  int      words  = L.wordRefsUsed, lines = L.displayLinesUsed, srcs = L.sourceLinesUsed;
+  uint32_t start  = srcs > 0 ? L.srcOffset[0] : 0;
+  uint32_t tlen   = (uint32_t)L.textPoolUsed;
+  bool     inBook = start <= s_bookTextLen && tlen <= s_bookTextLen - start &&
+                    memcmp(L.textPool, s_bookText + start, tlen) == 0;
+  size_t   bytes  = sizeof(ChunkLayout) + (size_t)words * 5 + (size_t)lines * 4 +
+                    (size_t)srcs * 8 + (inBook ? 0 : tlen);
+  uint8_t* p = (uint8_t*)heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM);
+  if (!p) return nullptr;
+
+  ChunkLayout* R = (ChunkLayout*)p;
+  *R             = L;
+  p += sizeof(ChunkLayout);
+  R->srcOffset       = keepArray(p, L.srcOffset, srcs);
+  R->wordOff         = keepArray(p, L.wordOff, words);
+  R->wordPos         = keepArray(p, L.wordPos, words);
+  R->lineWordStart   = keepArray(p, L.lineWordStart, lines);
+  R->srcLineStart    = keepArray(p, L.srcLineStart, srcs);
+  R->wordLen         = keepArray(p, L.wordLen, words);
+  R->lineWordCount   = keepArray(p, L.lineWordCount, lines);
+  R->lineBaseline    = keepArray(p, L.lineBaseline, lines);
+  R->srcLineCount    = keepArray(p, L.srcLineCount, srcs);
+  R->srcStyle        = keepArray(p, L.srcStyle, srcs);
+  R->textPool        = inBook ? s_bookText + start : keepArray(p, L.textPool, (int)tlen);
+  R->textPoolCap     = (int)tlen;
+  R->wordRefsCap     = words;
+  R->displayLinesCap = lines;
+  R->sourceLinesCap  = srcs;
+  R->chunk           = idx;
+  R->state           = SLOT_READY;
+
+  // The index and prefetch tasks can both lay out the chunk; the first one wins
+  xSemaphoreTake(s_windowLock, portMAX_DELAY);
+  ChunkLayout* kept = s_resident[idx];
+  if (!kept) kept = s_resident[idx] = R;
+  xSemaphoreGive(s_windowLock);
+  if (kept != R) heap_caps_free(R);
+  return kept;
+}
 
 // ── Chunk index ────────────────────────────────────────────────────────────────
-struct ChunkInfo {
-  size_t offset;
-  String heading;
+// <book>.idx is binary: an IdxHeader followed by chunkCount packed ChunkRecs.
+// Chunk headings are interned in one string arena, <book>.hdg: NUL-terminated
+// strings, offset 0 is always "". All fields are little-endian, written and
+// read as raw structs.
+//
+// Neither file is held in RAM. Records are paged in CHUNK_PAGE_RECS at a time
+// through a small LRU cache and headings are read when shown, so memory use is
+// the same for a novella and an omnibus. Only the last, partial page of
+// records stays resident (s_recTail); while the index task runs it fills that
+// page and appends it to the .idx once full.
+#define IDX_MAGIC   0x58494B42  // "BKIX"
+#define IDX_VERSION 9
+
+struct IdxHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t headerSize;    // sizeof(IdxHeader) when written
+  uint32_t bookSize;      // size of the .md file indexed
+  uint32_t bookMtime;     // its last-write time
+  uint32_t layoutHash;    // layoutParamHash() at build time
+  uint32_t chunkCount;
+  uint32_t totalPages;
+  uint32_t headingBytes;  // size of <book>.hdg
+  uint32_t tocCount;      // entries in <book>.toc, 0 = none
+};
+
+struct ChunkRec {
+  uint32_t offset;      // byte offset of the chunk's first source line
+  uint32_t headingOff;  // into <book>.hdg
+  uint32_t firstPage;   // global page the chunk starts on
+  uint16_t pageCount;   // 0 until the chunk has been laid out
+  uint16_t skip;        // display lines of that line in the previous chunk
 };
+static_assert(sizeof(IdxHeader) == 36, "IdxHeader is stored on SD as-is");
+static_assert(sizeof(ChunkRec) == 16, "ChunkRec is stored on SD as-is");
 
-static std::vector<ChunkInfo> chunks;
 static int   currentChunk     = 0;
 static ulong pageIndex        = 0;
 static bool  needsRedraw      = false;
 static bool  fileError        = false;
-static int s_pageCounts[MAX_CHUNKS] = {};  // page count per chunk, BSS
-static int s_numPageCounts          = 0;   // how many entries are valid
-static int s_totalPages             = 0;   // sum of all s_pageCounts
+static bool  indexError       = false;  // index files could not be created on SD
+static bool  memError         = false;  // no memory for the layout window
+static volatile int s_totalPages = 0;  // pages in the book, 0 until indexing finishes
+
+// While the index task runs it appends records and headings, so other tasks
+// read them through these accessors under s_indexLock. The lock also
+// serialises every open of the .idx and .hdg.
+static SemaphoreHandle_t s_indexLock = NULL;
+static volatile bool     s_indexing  = false;  // index task running
+static volatile bool     s_scanning  = false;  // ...and still finding chunk offsets
+
+struct RecPage {
+  int      page;     // holds records [page * CHUNK_PAGE_RECS, ...), -1 = none
+  uint32_t lastUse;
+  ChunkRec recs[CHUNK_PAGE_RECS];
+};
+
+static int      s_chunkCount   = 0;
+static int      s_tailBase     = 0;  // first record in s_recTail; all before it are in the .idx
+static ChunkRec s_recTail[CHUNK_PAGE_RECS];
+static RecPage  s_recCache[CHUNK_CACHE_PAGES];
+static uint32_t s_recClock     = 0;
+static uint32_t s_headingBytes = 0;  // size of the .hdg arena
+static uint32_t s_headCacheOff = 0;  // arena offset of s_headCache, 0 = none
+static char     s_headCache[64];
+
+static void clearChunkTable() {
+  s_chunkCount   = 0;
+  s_tailBase     = 0;
+  s_headingBytes = 0;
+  s_headCacheOff = 0;
+  for (RecPage& p : s_recCache) {
+    p.page    = -1;
+    p.lastUse = 0;
+  }
+}
+
+// Record c, from the tail or the page cache. Caller holds s_indexLock and
+// has checked c < s_chunkCount. False if the .idx cannot be read.
+static bool chunkRecLocked(int c, ChunkRec& out) {
+  if (c >= s_tailBase) {
+    out = s_recTail[c - s_tailBase];
+    return true;
+  }
+  int      page   = c / CHUNK_PAGE_RECS;
+  RecPage* victim = &s_recCache[0];
+  for (RecPage& p : s_recCache) {
+    if (p.page == page) {
+      p.lastUse = ++s_recClock;
+      out       = p.recs[c % CHUNK_PAGE_RECS];
+      return true;
+    }
+    if (p.lastUse < victim->lastUse) victim = &p;
+  }
+
+  // Every page before the tail is full, so it is always one read
+  File f  = SD_MMC.open(s_idxPath, FILE_READ);
+  bool ok = f && f.seek(sizeof(IdxHeader) + (uint32_t)page * sizeof(victim->recs)) &&
+            f.read((uint8_t*)victim->recs, sizeof(victim->recs)) == sizeof(victim->recs);
+  if (f) f.close();
+  victim->page    = ok ? page : -1;
+  victim->lastUse = ++s_recClock;
+  if (ok) out = victim->recs[c % CHUNK_PAGE_RECS];
+  else ESP_LOGE(TAG, "Cannot read chunk record %d of %s", c, s_bookDisplayName);
+  return ok;
+}
+
+// False if chunk c is unknown.
+static bool chunkRec(int c, ChunkRec& out) {
+  xSemaphoreTake(s_indexLock, portMAX_DELAY);
+  bool ok = c >= 0 && c < s_chunkCount && chunkRecLocked(c, out);
+  xSemaphoreGive(s_indexLock);
+  return ok;
+}
+
+static int chunkCount() {
+  xSemaphoreTake(s_indexLock, portMAX_DELAY);
+  int n = s_chunkCount;
+  xSemaphoreGive(s_indexLock);
+  return n;
+}
+
+// True if chunk c exists or the running scan may still find it.
+static bool hasChunk(int c) {
+  return c >= 0 && (c < chunkCount() || s_scanning);
+}
+
+// True once chunk c's byte range is final, i.e. it can be laid out.
+static bool chunkReady(int c) {
+  int n = chunkCount();
+  return c >= 0 && (c + 1 < n || (c < n && !s_scanning));
+}
+
+// Where a chunk starts and ends. A boundary with skip > 0 falls inside the
+// source line at that offset, after `skip` of its display lines.
+struct ChunkSpan {
+  uint32_t start;
+  uint16_t startSkip;
+  uint32_t end;  // BOOK_END for the last chunk
+  uint16_t endSkip;
+};
+#define BOOK_END 0xFFFFFFFFu
+
+// False if chunk c is unknown.
+static bool chunkSpan(int c, ChunkSpan& out) {
+  xSemaphoreTake(s_indexLock, portMAX_DELAY);
+  ChunkRec rec, next;
+  bool     ok      = c >= 0 && c < s_chunkCount && chunkRecLocked(c, rec);
+  bool     hasNext = ok && c + 1 < s_chunkCount;
+  if (hasNext) ok = chunkRecLocked(c + 1, next);
+  xSemaphoreGive(s_indexLock);
+
+  if (ok) {
+    out.start     = rec.offset;
+    out.startSkip = rec.skip;
+    out.end       = hasNext ? next.offset : BOOK_END;
+    out.endSkip   = hasNext ? next.skip : 0;
+  }
+  return ok;
+}
+
+// Read from the arena on first use; the last one shown is kept.
+static String chunkHeading(int c) {
+  xSemaphoreTake(s_indexLock, portMAX_DELAY);
+  ChunkRec rec;
+  String   h;
+  if (c >= 0 && c < s_chunkCount && chunkRecLocked(c, rec) && rec.headingOff != 0 &&
+      rec.headingOff < s_headingBytes) {
+    if (rec.headingOff != s_headCacheOff) {
+      size_t got = 0;
+      File   f   = SD_MMC.open(s_hdgPath, FILE_READ);
+      if (f) {
+        if (f.seek(rec.headingOff)) got = f.read((uint8_t*)s_headCache, sizeof(s_headCache) - 1);
+        f.close();
+      }
+      s_headCache[got] = '\0';
+      s_headCacheOff   = got ? rec.headingOff : 0;
+    }
+    h = s_headCache;
+  }
+  xSemaphoreGive(s_indexLock);
+  return h;
+}
+
+// ── Chunk lookups ─────────────────────────────────────────────────────────────
+// Offsets, first pages and heading offsets never decrease along the table
+// (headings are interned in reading order), so every lookup is a binary search
+// over records paged in through the cache: O(log n) whatever the book's length.
+
+// First chunk in [lo, hi) for which pred(rec) holds, or hi; pred must be false
+// then true along the table. Caller holds s_indexLock.
+template <typename Pred>
+static int chunkLowerBound(int lo, int hi, Pred pred) {
+  while (lo < hi) {
+    int      mid = lo + (hi - lo) / 2;
+    ChunkRec rec;
+    if (!chunkRecLocked(mid, rec)) return hi;
+    if (pred(rec)) hi = mid;
+    else lo = mid + 1;
+  }
+  return lo;
+}
+
+// Chunk holding byte `offset` of the book, as far as the index has got. With
+// `skip`, the chunk holding that display line of the source line at `offset`
+// when chunks are cut inside it.
+static int chunkAtOffset(uint32_t offset, uint16_t skip = 0xFFFF) {
+  xSemaphoreTake(s_indexLock, portMAX_DELAY);
+  int c = chunkLowerBound(0, s_chunkCount, [&](const ChunkRec& r) {
+    return r.offset > offset || (r.offset == offset && r.skip > skip);
+  });
+  xSemaphoreGive(s_indexLock);
+  return max(c - 1, 0);
+}
+
+// First chunk of the heading that chunk c falls under.
+static int headingStart(int c) {
+  xSemaphoreTake(s_indexLock, portMAX_DELAY);
+  ChunkRec rec;
+  int      start = c;
+  if (c >= 0 && c < s_chunkCount && chunkRecLocked(c, rec))
+    start = chunkLowerBound(0, c, [&](const ChunkRec& r) { return r.headingOff >= rec.headingOff; });
+  xSemaphoreGive(s_indexLock);
+  return start;
+}
+
+// First chunk after c under a later heading, or -1 if none is indexed yet.
+static int nextHeading(int c) {
+  xSemaphoreTake(s_indexLock, portMAX_DELAY);
+  ChunkRec rec;
+  int      next = -1;
+  if (c >= 0 && c < s_chunkCount && chunkRecLocked(c, rec)) {
+    next = chunkLowerBound(c + 1, s_chunkCount,
+                           [&](const ChunkRec& r) { return r.headingOff > rec.headingOff; });
+    if (next == s_chunkCount) next = -1;
+  }
+  xSemaphoreGive(s_indexLock);
+  return next;
+}
+
+// ── Page table ────────────────────────────────────────────────────────────────
+// One fixed-size record per global page in <book>.pgt, written by the index task.
+// A record holds everything needed to lay out that page on its own: the
+// source line it starts in, how many of that line's display lines belong to
+// the previous page, and the ordered-list counter at that point.
+struct PageRec {
+  uint32_t offset;     // byte offset of the source line the page starts in
+  uint16_t chunk;
+  uint16_t localPage;  // page within `chunk`
+  uint16_t skip;       // leading display lines of that source line to drop
+  uint16_t listNum;    // ordered-list counter to resume with
+};
+static_assert(sizeof(PageRec) == 12, "PageRec is stored on SD as-is");
+
+static bool      s_hasPageTable = false;
+static bool      s_hasWordIndex = false;  // <book>.wix matches the loaded index
+static IdxHeader s_stamp;                 // book and layout the index is for; magic 0 = none
+
+// ── Table of contents ─────────────────────────────────────────────────────────
+// One record per heading of any level in <book>.toc, in book order, written
+// by the index task. The text is interned in the .hdg arena with the chunk
+// headings. Read a screenful at a time while the TOC is shown.
+struct TocRec {
+  uint32_t offset;   // byte offset of the heading line
+  uint32_t page;     // 0-based global page it starts on
+  uint32_t textOff;  // into <book>.hdg
+  uint8_t  level;    // 1-3 for # to ###
+  uint8_t  reserved[3];
+};
+static_assert(sizeof(TocRec) == 16, "TocRec is stored on SD as-is");
+
+#define TOC_VISIBLE PICKER_VISIBLE
+
+static int s_tocCount  = 0;  // entries in the .toc, 0 until the index is complete
+static int s_tocSel    = 0;
+static int s_tocScroll = 0;
+
+// ── Chunk transitions ─────────────────────────────────────────────────────────
+// Chunk switches are requested from processKB_APP() and carried out on the
+// e-ink task, which is the only reader of the layout pools.
+#define LAST_PAGE 65535  // page sentinel: clamped to the chunk's last page by resolveView()
+
+static volatile int   s_pendingChunk = -1;  // chunk waiting to be loaded, -1 = none
+static volatile ulong s_pendingPage  = 0;
+
+// A bookmark loaded but not yet placed in a chunk, as (offset, skip)
+static volatile bool s_markPending = false;
+static uint32_t      s_markOffset  = 0;
+static uint16_t      s_markSkip    = 0;
+static bool          s_markPreview = false;  // page view laid out from the mark alone
 
 // ── Page jump ─────────────────────────────────────────────────────────────────
 static char s_jumpBuf[5] = "";
 static int  s_jumpLen    = 0;
 
+// ── Search ────────────────────────────────────────────────────────────────────
+static char     s_query[Horspool::MAX_PATTERN + 1] = "";
+static int      s_queryLen    = 0;
+static bool     s_searchMiss  = false;  // last search found nothing
+static uint32_t s_hits[SEARCH_MAX_HITS];  // book offsets of the matches, in order
+static int      s_hitCount    = 0;        // entries in s_hits
+static int      s_hitTotal    = 0;        // matches in the book, may exceed s_hitCount
+static int      s_hitSel      = -1;       // hit shown last, -1 = none
+
 // ── Touch scroll ──────────────────────────────────────────────────────────────
 static long int          s_scrollBase          = 0;
 static unsigned long     s_scrollCooldownUntil = 0;
 static const int         SWIPE_THRESHOLD       = 3;
 static const unsigned long SWIPE_COOLDOWN_MS   = 500;
 
-// ── Helpers ───────────────────────────────────────────────────────────────────
-static int getMaxPage() {
-  return (s_displayLinesUsed <= 0) ? 0 : (s_displayLinesUsed - 1) / LINES_PER_PAGE;
+// ── Helpers ───────────────────────────────────────────────────────────────────
+static int getMaxPage(const ChunkLayout& L) {
+  return (L.displayLinesUsed <= 0) ? 0 : (L.displayLinesUsed - 1) / LINES_PER_PAGE;
+}
+
+static int getMaxPage() { return getMaxPage(*s_cur); }
+
+// Last page of chunk c: from the index when known, else from the resident layout.
+static int chunkMaxPage(int c) {
+  ChunkRec rec;
+  if (chunkRec(c, rec) && rec.pageCount > 0) return rec.pageCount - 1;
+  return getMaxPage();
+}
+
+static int chunkFirstPage(int c) {
+  ChunkRec rec;
+  return chunkRec(c, rec) ? (int)rec.firstPage : 0;
+}
+
+// Chunk and local page of 0-based globalPage; false if it is not indexed yet.
+// The way back is chunkFirstPage(chunk) + localPage.
+static bool findPage(int globalPage, int& chunk, int& localPage) {
+  xSemaphoreTake(s_indexLock, portMAX_DELAY);
+  int c = chunkLowerBound(0, s_chunkCount,
+                          [&](const ChunkRec& r) { return (int)r.firstPage > globalPage; }) - 1;
+  ChunkRec rec;
+  bool ok = c >= 0 && chunkRecLocked(c, rec) && rec.pageCount > 0 &&
+            globalPage < (int)(rec.firstPage + rec.pageCount);
+  xSemaphoreGive(s_indexLock);
+  if (ok) {
+    chunk     = c;
+    localPage = globalPage - (int)rec.firstPage;
+  }
+  return ok;
+}
+
+static bool readPageRec(int globalPage, PageRec& out) {
+  if (!s_hasPageTable || globalPage < 0 || globalPage >= s_totalPages) return false;
+  File f = SD_MMC.open(s_pgtPath, FILE_READ);
+  if (!f) return false;
+  bool ok = f.seek((uint32_t)globalPage * sizeof(PageRec)) &&
+            f.read((uint8_t*)&out, sizeof(PageRec)) == sizeof(PageRec);
+  f.close();
+  return ok;
+}
+
+// Chunk and local page showing byte `offset`: the last page of its chunk
+// that starts at or before it (and at or before display line `skip` of the
+// source line there), found by binary search in the page table. Without a
+// page table, the chunk's first page.
+static void pageAtOffset(uint32_t offset, int& chunk, int& localPage, uint16_t skip = 0xFFFF) {
+  chunk     = chunkAtOffset(offset, skip);
+  localPage = 0;
+  ChunkRec rec;
+  if (!s_hasPageTable || !chunkRec(chunk, rec)) return;
+  File f = SD_MMC.open(s_pgtPath, FILE_READ);
+  if (!f) return;
+  int lo = 0, hi = rec.pageCount;  // first page that starts after offset
+  while (lo < hi) {
+    int     mid = lo + (hi - lo) / 2;
+    PageRec pr;
+    if (!f.seek((rec.firstPage + mid) * sizeof(PageRec)) ||
+        f.read((uint8_t*)&pr, sizeof(pr)) != sizeof(pr))
+      break;
+    if (pr.offset > offset || (pr.offset == offset && pr.skip > skip)) hi = mid;
+    else lo = mid + 1;
+  }
+  f.close();
+  localPage = max(lo - 1, 0);
+}
+
+// Returns 1-based global page and total. The page is -1 until the index has
+// reached the current chunk, the total -1 until indexing finishes. Reads
+// currentChunk at call time (after loadBookmark).
+static void getGlobalPageInfo(int& outPage, int& outTotal) {
+  ChunkRec rec;
+  outPage  = chunkRec(currentChunk, rec) ? (int)rec.firstPage + (int)pageIndex + 1 : -1;
+  outTotal = (s_totalPages > 0) ? s_totalPages : -1;
+}
+
+// ── Layout ────────────────────────────────────────────────────────────────────
+
+// Layout never touches `display`: words are measured with FontMetrics from
+// the fonts' glyph tables, so any task can lay out while the e-ink task draws.
+static int s_pageWidth = 0;  // display.width(), set once in APP_INIT()
+
+// Reads the text from byte `start` of the book into L's text pool with one
+// read, or a copy when the book is resident: up to `end` when that is a line
+// boundary (endSkip == 0), else as much as fits. Returns the line splitter
+// over it; an empty one if the read fails. Lines longer than LINE_BUF_SIZE - 1
+// bytes are cut into pieces of that size.
+static LineSplitter readText(ChunkLayout& L, File& f, uint32_t start, uint32_t end,
+                             int endSkip) {
+  size_t want    = (size_t)L.textPoolCap;
+  bool   bounded = end != BOOK_END && endSkip == 0;
+  if (bounded && end >= start && end - start < want) want = end - start;
+  size_t got = 0;
+  if (s_bookText) {
+    got = start < s_bookTextLen ? min(want, (size_t)(s_bookTextLen - start)) : 0;
+    memcpy(L.textPool, s_bookText + start, got);
+  } else if (want > 0 && f.seek(start)) {
+    got = f.read((uint8_t*)L.textPool, want);
+  }
+  L.textPoolUsed = (int)got;
+  return LineSplitter(L.textPool, got, LINE_BUF_SIZE, got < want || (bounded && got == want));
+}
+
+// Opens the book for readText(). A resident book needs no file, so f is left
+// closed. Returns false if the book cannot be opened.
+static bool openBookText(File& f) {
+  if (s_bookText) return true;
+  f = SD_MMC.open(s_bookPath, FILE_READ);
+  if (!f) fileError = true;
+  return (bool)f;
+}
+
+// Trims a line view of the text pool of surrounding whitespace.
+static void trimLine(const ChunkLayout& L, size_t off, size_t len, const char*& line, int& n) {
+  const char* p = L.textPool + off;
+  while (len > 0 && isspace((unsigned char)*p)) {
+    p++;
+    len--;
+  }
+  while (len > 0 && isspace((unsigned char)p[len - 1])) len--;
+  line = p;
+  n    = (int)len;
+}
+
+static void commitDisplayLine(ChunkLayout& L, int wordStart, int wordCount, int baseline,
+                              int si) {
+  if (L.overflow) return;
+  if (L.displayLinesUsed >= L.displayLinesCap) {
+    L.overflow = true;
+    return;
+  }
+  int li = L.displayLinesUsed++;
+  L.lineWordStart[li] = (uint16_t)wordStart;
+  L.lineWordCount[li] = (uint8_t)(wordCount > 255 ? 255 : wordCount);
+  L.lineBaseline[li]  = (uint8_t)min(baseline, 255);
+  L.srcLineCount[si]++;
+}
+
+// Display line currently being filled by layoutSegment().
+struct LineBuilder {
+  int wordStart;  // first word of the open line
+  int wordCount;
+  int width;      // px used so far
+  int height;     // tallest word so far
+  int space;      // px left after the last word, for the next one
+  bool glue;      // the last run ended inside a word: its next run continues it
+  int skip;       // leading display lines still to drop (page view resume)
+  int keep;       // display lines still to commit after those, -1 = all
+};
+
+static void closeDisplayLine(ChunkLayout& L, LineBuilder& lb, int si) {
+  if (lb.skip > 0 || lb.keep == 0) {
+    if (lb.skip > 0) lb.skip--;
+    L.wordRefsUsed = lb.wordStart;
+  } else {
+    // Headings get a little extra room above the baseline
+    bool heading = L.srcStyle[si] == '1' || L.srcStyle[si] == '2' || L.srcStyle[si] == '3';
+    commitDisplayLine(L, lb.wordStart, lb.wordCount, lb.height + (heading ? 4 : 0), si);
+    if (lb.keep > 0) lb.keep--;
+  }
+  lb.wordStart = L.wordRefsUsed;
+  lb.wordCount = 0;
+  lb.width     = 0;
+  lb.height    = 0;
+}
+
+// Lays out one run of forEachRun() (RUN_* flags), which lies in L's text
+// pool. A run that starts inside a word, after an emphasis marker or escape,
+// is drawn flush against it.
+static void layoutSegment(ChunkLayout& L, const char* seg, int segLen, uint8_t flags,
+                          char style, uint16_t textWidth, LineBuilder& lb, int si) {
+  FontMetrics fm(pickFont(style, flags & RUN_BOLD, flags & RUN_ITALIC, flags & RUN_CODE));
+  int         sw = fm.advance(SPACEWIDTH_SYMBOL);
+
+  int wStart = 0;
+  while (wStart < segLen && lb.keep != 0) {
+    int wEnd = wStart;
+    while (wEnd < segLen && seg[wEnd] != ' ') wEnd++;
+    int wLen = wEnd - wStart;
+    if (wLen > 0) {
+      if (wStart == 0 && lb.glue && lb.wordCount > 0) lb.width -= lb.space;
+      if (L.wordRefsUsed >= L.wordRefsCap) {
+        L.overflow = true;
+        return;
+      }
+
+      int wpx, hpx;
+      wLen = min(wLen, MAX_WORD_LEN);
+      fm.measure(seg + wStart, wLen, wpx, hpx);
+      int addWidth = wpx + sw + WORDWIDTH_BUFFER;
+
+      if (lb.width > 0 && lb.width + addWidth > (int)textWidth) closeDisplayLine(L, lb, si);
+      int wi = L.wordRefsUsed++;
+      L.wordOff[wi] = (uint16_t)(seg + wStart - L.textPool);
+      L.wordLen[wi] = (uint8_t)wLen;
+      L.wordPos[wi] = (uint16_t)((lb.width & WORD_X_MASK) | flags << WORD_FLAG_SHIFT);
+      lb.wordCount++;
+      lb.width += addWidth;
+      lb.height = max(lb.height, hpx);
+      lb.space  = sw + WORDWIDTH_BUFFER;
+    }
+    wStart = wEnd + 1;
+  }
+  lb.glue = segLen > 0 && seg[segLen - 1] != ' ';
+}
+
+// Lays one source line (raw[0..n), inside L's text pool) out into L. `skip` drops
+// that many leading display lines, which is how a page view or chunk resumes
+// inside a wrapped paragraph; with `limit` >= 0 only display lines before
+// that one are kept, for a chunk that ends inside it. If a pool fills up,
+// L.overflow is set and the display lines committed so far stay valid.
+static void layoutSourceLine(ChunkLayout& L, const char* raw, int n, char style,
+                             uint32_t offset, int skip = 0, int limit = -1) {
+  if (L.overflow) return;
+  if (L.sourceLinesUsed >= L.sourceLinesCap) {
+    L.overflow = true;
+    return;
+  }
+
+  int si = L.sourceLinesUsed++;
+  L.srcStyle[si]     = style;
+  L.srcOffset[si]    = offset;
+  L.srcLineStart[si] = (uint16_t)L.displayLinesUsed;
+  L.srcLineCount[si] = 0;
+
+  if (style == 'B' || style == 'H') {
+    commitDisplayLine(L, L.wordRefsUsed, 0, 0, si);
+    return;
+  }
+
+  uint16_t textWidth = (uint16_t)(s_pageWidth - DISPLAY_WIDTH_BUFFER);
+  if (style == '>' || style == 'C')
+    textWidth -= SPECIAL_PADDING;
+  else if (style == '-' || style == 'L')
+    textWidth -= 2 * SPECIAL_PADDING;
+
+  LineBuilder lb;
+  lb.wordStart = L.wordRefsUsed;
+  lb.wordCount = 0;
+  lb.width     = 0;
+  lb.height    = 0;
+  lb.space     = 0;
+  lb.glue      = false;
+  lb.skip      = skip;
+  lb.keep      = (limit < 0) ? -1 : max(limit - skip, 0);
+
+  forEachRun(raw, (size_t)n, [&](const char* run, size_t len, uint8_t flags) {
+    if (!L.overflow && lb.keep != 0)
+      layoutSegment(L, run, (int)len, flags, style, textWidth, lb, si);
+  });
+
+  if (lb.wordCount > 0)
+    closeDisplayLine(L, lb, si);
+}
+
+// Lays out the placeholder shown for a chunk with no text.
+static void layoutEmpty(ChunkLayout& L, uint32_t offset) {
+  static const char EMPTY[] = "(empty)";
+  memcpy(L.textPool, EMPTY, sizeof(EMPTY) - 1);
+  L.textPoolUsed = sizeof(EMPTY) - 1;
+  layoutSourceLine(L, L.textPool, L.textPoolUsed, 'T', offset);
+}
+
+static bool startsWith(const char* s, int len, const char* prefix, int plen) {
+  return len >= plen && memcmp(s, prefix, plen) == 0;
+}
+
+// Returns the style of a trimmed source line and points content/clen at the
+// text to lay out, inside the line.
+static char classifyLine(const char* raw, int len, const char*& content, int& clen) {
+  int skip = 0;
+  char st  = 'T';
+  if (len == 0) {
+    st = 'B';
+  } else if (len == 3 && memcmp(raw, "---", 3) == 0) {
+    st = 'H';
+  } else if (startsWith(raw, len, "# ", 2)) {
+    st = '1'; skip = 2;
+  } else if (startsWith(raw, len, "## ", 3)) {
+    st = '2'; skip = 3;
+  } else if (startsWith(raw, len, "### ", 4)) {
+    st = '3'; skip = 4;
+  } else if (startsWith(raw, len, "> ", 2)) {
+    st = '>'; skip = 2;
+  } else if (startsWith(raw, len, "- ", 2)) {
+    st = '-'; skip = 2;
+  } else if (startsWith(raw, len, "```", 3)) {
+    st = 'C';
+  } else if (len >= 3 && isDigit(raw[0]) && raw[1] == '.' && raw[2] == ' ') {
+    st = 'L'; skip = 3;
+  }
+  if (st == 'B' || st == 'H' || st == 'C') skip = len;  // no text of their own
+  content = raw + skip;
+  clen    = len - skip;
+  return st;
+}
+
+// ── Index building ─────────────────────────────────────────────────────────────
+
+// Appends one PageRec per page of chunk `idx`, laid out in L, to the page table.
+// `firstSkip` is the chunk's ChunkRec::skip.
+static void writePageRecs(File& pgt, const ChunkLayout& L, int idx, int firstSkip) {
+  int pages = getMaxPage(L) + 1;
+  int si    = 0;
+  for (int p = 0; p < pages; p++) {
+    int first = p * LINES_PER_PAGE;
+    while (si + 1 < L.sourceLinesUsed && L.srcLineStart[si] + L.srcLineCount[si] <= first) si++;
+    int lineStart = L.srcLineStart[si];
+
+    PageRec pr;
+    pr.offset    = L.srcOffset[si];
+    pr.chunk     = (uint16_t)idx;
+    pr.localPage = (uint16_t)p;
+    pr.skip      = (uint16_t)((si == 0 ? firstSkip : 0) +
+                              (first > lineStart ? first - lineStart : 0));
+    pr.listNum   = (uint16_t)(L.srcStyle[si] == 'L' ? listNumber(L, si) : 1);
+    pgt.write((const uint8_t*)&pr, sizeof(pr));
+  }
+}
+
+static uint32_t fnv1a(uint32_t h, const void* data, size_t len) {
+  const uint8_t* p = (const uint8_t*)data;
+  for (size_t i = 0; i < len; i++) {
+    h ^= p[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+// Glyph metrics only: bitmaps don't move line breaks.
+static uint32_t hashFont(uint32_t h, const GFXfont* font) {
+  if (!font) return fnv1a(h, "-", 1);
+  h = fnv1a(h, &font->first, sizeof(font->first));
+  h = fnv1a(h, &font->last, sizeof(font->last));
+  h = fnv1a(h, &font->yAdvance, sizeof(font->yAdvance));
+  for (int c = 0; c <= font->last - font->first; c++) {
+    const GFXglyph& g = font->glyph[c];
+    const uint8_t m[5] = {g.width, g.height, g.xAdvance, (uint8_t)g.xOffset, (uint8_t)g.yOffset};
+    h = fnv1a(h, m, sizeof(m));
+  }
+  return h;
+}
+
+// Hash of everything that decides where chunks and pages break: layout
+// constants, the text width and the metrics of every font in s_fonts. Any
+// change makes loadIndex() discard the index. Call after initFonts().
+static uint32_t layoutParamHash() {
+  const uint32_t params[] = {IDX_VERSION, LINES_PER_PAGE, LINES_PER_CHUNK, DISPLAY_WIDTH_BUFFER,
+                             SPECIAL_PADDING, WORDWIDTH_BUFFER, MAX_WORD_LEN,
+                             TEXT_POOL_CAP, WORD_REF_CAP, DISPLAY_LINE_CAP, LINE_BUF_SIZE,
+                             (uint32_t)s_pageWidth};
+  uint32_t h = fnv1a(2166136261u, params, sizeof(params));
+  h = fnv1a(h, SPACEWIDTH_SYMBOL, sizeof(SPACEWIDTH_SYMBOL));
+
+  const GFXfont* const fonts[] = {s_fonts.normal, s_fonts.normal_B, s_fonts.normal_I,
+                                  s_fonts.normal_BI, s_fonts.h1, s_fonts.h1_B,
+                                  s_fonts.h2, s_fonts.h2_B, s_fonts.h3, s_fonts.h3_B,
+                                  s_fonts.code, s_fonts.quote, s_fonts.list};
+  for (const GFXfont* font : fonts) h = hashFont(h, font);
+  return h;
+}
+
+// Appends str to the heading arena, open for append in hdg, and returns its
+// offset, or 0 ("") if the arena cannot be written; hdg is closed then, so
+// later headings are not put at the wrong offsets. Flushed at once, as
+// chunkHeading() reads it through its own handle. Caller holds s_indexLock.
+static uint32_t internHeading(File& hdg, const char* str) {
+  if (!hdg) return 0;
+  size_t   n   = strlen(str) + 1;
+  uint32_t off = s_headingBytes;
+  if (hdg.write((const uint8_t*)str, n) != n) {
+    hdg.close();
+    return 0;
+  }
+  hdg.flush();
+  s_headingBytes += (uint32_t)n;
+  return off;
+}
+
+// Writes n records starting at record `first` into the .idx, and hdr at its
+// start if given. The file must exist. Caller holds s_indexLock or is the
+// only user of the index.
+static bool writeChunkRecs(int first, const ChunkRec* recs, int n, const IdxHeader* hdr) {
+  File f = SD_MMC.open(s_idxPath, "r+");
+  if (!f) return false;
+  size_t bytes = (size_t)n * sizeof(ChunkRec);
+  bool   ok    = f.seek(sizeof(IdxHeader) + (uint32_t)first * sizeof(ChunkRec)) &&
+                 f.write((const uint8_t*)recs, bytes) == bytes;
+  if (ok && hdr) ok = f.seek(0) && f.write((const uint8_t*)hdr, sizeof(*hdr)) == sizeof(*hdr);
+  f.close();
+  return ok;
+}
+
+// First record of the tail page that holds the last of n records.
+static int tailBaseFor(int n) {
+  return n > 0 ? (n - 1) / CHUNK_PAGE_RECS * CHUNK_PAGE_RECS : 0;
+}
+
+static void clearIndex() {
+  clearChunkTable();
+  s_totalPages   = 0;
+  s_hasPageTable = false;
+  s_hasWordIndex = false;
+  s_tocCount     = 0;
+  s_stamp.magic  = 0;
+}
+
+// ── Index checkpoints ─────────────────────────────────────────────────────────
+// The index task saves its progress to <book>.ick every CHECKPOINT_EVERY
+// chunks (and when the reader is closed mid-build), so an interrupted build
+// resumes where it stopped instead of starting over. Layout: IdxCheckpoint,
+// then the records of the tail page; earlier records are already in the .idx,
+// headings in the .hdg and TOC entries in the .toc. Checkpoints are only taken at chunk boundaries,
+// when every chunk so far has its page count and PageRecs written.
+#define CHECKPOINT_EVERY 8  // chunks between index checkpoints
+
+struct IdxCheckpoint {
+  IdxHeader hdr;           // stamp of the build; chunkCount/headingBytes so far
+  uint32_t  scanOffset;    // where the next chunk starts, as (offset, skip)
+  uint32_t  pagesCounted;  // PageRecs written so far
+  uint32_t  tocCount;      // TocRecs written so far
+  uint32_t  headOff;       // arena offset of the last "# " heading
+  uint16_t  scanSkip;      // display lines of the line at scanOffset already indexed
+  uint16_t  reserved;
+};
+
+static IdxCheckpoint s_ick;  // state of the running build
+
+// Called from the index task, the only writer of the chunk table while it runs.
+static void saveCheckpoint(IdxCheckpoint& ck) {
+  ck.hdr.chunkCount   = (uint32_t)s_chunkCount;
+  ck.hdr.headingBytes = s_headingBytes;
+  File f = SD_MMC.open(s_ickPath, FILE_WRITE);
+  if (!f) return;
+  f.write((const uint8_t*)&ck, sizeof(ck));
+  f.write((const uint8_t*)s_recTail, (s_chunkCount - s_tailBase) * sizeof(ChunkRec));
+  f.close();
+}
+
+// Restores the chunk table from a checkpoint taken for the same book contents
+// and layout as `stamp`. Returns false if there is none to resume, or if the
+// .idx or .hdg it continues are missing or short.
+static bool loadCheckpoint(IdxCheckpoint& ck, const IdxHeader& stamp) {
+  if (!SD_MMC.exists(s_ickPath) || !SD_MMC.exists(s_idxPath) || !SD_MMC.exists(s_hdgPath))
+    return false;
+  File f = SD_MMC.open(s_ickPath, FILE_READ);
+  if (!f) return false;
+
+  bool ok = f.read((uint8_t*)&ck, sizeof(ck)) == sizeof(ck) &&
+            ck.hdr.magic == IDX_MAGIC && ck.hdr.version == IDX_VERSION &&
+            ck.hdr.bookSize == stamp.bookSize && ck.hdr.bookMtime == stamp.bookMtime &&
+            ck.hdr.layoutHash == stamp.layoutHash && ck.hdr.chunkCount > 0 &&
+            ck.hdr.headingBytes > 0;
+  int    n         = ok ? (int)ck.hdr.chunkCount : 0;
+  int    base      = tailBaseFor(n);
+  size_t tailBytes = (size_t)(n - base) * sizeof(ChunkRec);
+  ok = ok && f.size() == sizeof(ck) + tailBytes &&
+       f.read((uint8_t*)s_recTail, tailBytes) == tailBytes;
+  f.close();
+
+  // Pages flushed after the checkpoint are rewritten with the same records,
+  // and headings interned after it are left unreferenced.
+  uint32_t hdgSize = 0;
+  if (ok) {
+    File idx = SD_MMC.open(s_idxPath, FILE_READ);
+    File hdg = SD_MMC.open(s_hdgPath, FILE_READ);
+    ok = idx && hdg && idx.size() >= sizeof(IdxHeader) + (size_t)base * sizeof(ChunkRec) &&
+         hdg.size() >= ck.hdr.headingBytes;
+    if (hdg) hdgSize = (uint32_t)hdg.size();
+    if (idx) idx.close();
+    if (hdg) hdg.close();
+  }
+  if (!ok) return false;
+
+  s_chunkCount   = n;
+  s_tailBase     = base;
+  s_headingBytes = hdgSize;
+  return true;
+}
+
+// ── Background indexing ───────────────────────────────────────────────────────
+// A book without a valid index opens straight away: chunk 0 (or the
+// bookmarked chunk) is laid out as soon as the index task has found where it
+// ends, while the task finishes the book at idle priority on core 0. The task
+// lays out into its own heap pools (PSRAM when present), so it never competes
+// for a window slot.
+static TaskHandle_t  s_indexHandle = NULL;
+static volatile bool s_indexStop   = false;  // set by stopIndexing()
+static volatile bool s_oledDirty   = false;  // page total became known
+
+// The record of the chunk being indexed. Index task only; it is the one
+// writer, so it reads the tail without the lock.
+static ChunkRec& lastChunk() {
+  return s_recTail[s_chunkCount - 1 - s_tailBase];
+}
+
+// Appends a (term, chunk) pair to the word log for every distinct word and
+// word prefix (forEachIndexTerm()) in the chunk's text, L's text pool up to
+// `textLen`. The raw text rather than the laid-out words, so the index holds
+// exactly the words a search can match: list numbers, code fence labels and
+// the tails of words cut at MAX_WORD_LEN included. WORD_SET_SLOTS holds the
+// terms of any chunk text. <book>.wlg is turned into the word index once the
+// book is done.
+static void logChunkWords(const ChunkLayout& L, size_t textLen, uint32_t chunk, WordSet& set,
+                          File& wlg) {
+  set.clear();
+  forEachIndexTerm(L.textPool, textLen, [&](uint32_t h) { set.insert(h); });
+  WordPair buf[32];
+  size_t   n = 0;
+  set.forEach([&](uint32_t h) {
+    buf[n++] = {h, chunk};
+    if (n == 32) {
+      wlg.write((const uint8_t*)buf, sizeof(buf));
+      n = 0;
+    }
+  });
+  if (n) wlg.write((const uint8_t*)buf, n * sizeof(WordPair));
+}
+
+// Records the page count and PageRecs of the chunk laid out in L, which is
+// the last one in the table, and wakes the e-ink task if it was waiting.
+static void finishChunk(IdxCheckpoint& ck, ChunkLayout& L, File& pgt) {
+  int       idx = s_chunkCount - 1;
+  ChunkRec& rec = lastChunk();
+  if (L.sourceLinesUsed == 0) layoutEmpty(L, rec.offset);  // as loadChunk() does
+  uint16_t pages = (uint16_t)(getMaxPage(L) + 1);
+  if (pgt) writePageRecs(pgt, L, idx, rec.skip);
+
+  xSemaphoreTake(s_indexLock, portMAX_DELAY);
+  rec.pageCount = pages;
+  xSemaphoreGive(s_indexLock);
+  if (idx == currentChunk) s_oledDirty = true;
+  ck.pagesCounted += pages;
+}
+
+// Appends the chunk starting at (offset, skip) to the table, first moving a
+// full tail page out to the .idx. False if that write fails.
+static bool beginChunk(IdxCheckpoint& ck, uint32_t offset, int skip) {
+  ChunkRec ci;
+  memset(&ci, 0, sizeof(ci));
+  ci.offset    = offset;
+  ci.skip      = (uint16_t)skip;
+  ci.firstPage = ck.pagesCounted;
+
+  xSemaphoreTake(s_indexLock, portMAX_DELAY);
+  bool ok = true;
+  if (s_chunkCount - s_tailBase == CHUNK_PAGE_RECS) {
+    ok = writeChunkRecs(s_tailBase, s_recTail, CHUNK_PAGE_RECS, nullptr);
+    if (ok) s_tailBase += CHUNK_PAGE_RECS;
+  }
+  if (ok) {
+    ci.headingOff = ck.headOff;
+    s_recTail[s_chunkCount - s_tailBase] = ci;
+    s_chunkCount++;
+  }
+  xSemaphoreGive(s_indexLock);
+  if (!ok) {
+    ESP_LOGE(TAG, "Cannot write %s", s_idxPath);
+    return false;
+  }
+
+  // The previous chunk's end is now known; a bookmark waits for its own chunk
+  int c = s_pendingChunk;
+  if (c >= 0 && s_markPending) c = chunkAtOffset(s_markOffset, s_markSkip);
+  if (c >= 0 && chunkReady(c)) needsRedraw = true;
+  return true;
+}
+
+// One streaming pass over the book from ck.scanOffset. Each chunk's text is
+// read into L's text pool from the chunk's start, as loadChunk() reads it;
+// each source line is classified and laid out into L, and the chunk is
+// closed with its page count, PageRecs and heading once it holds
+// LINES_PER_CHUNK lines, the next line would overflow one of its pools, or
+// the next line goes on past the text read. That line then starts the next
+// chunk, or, if it overflows even an empty chunk, is cut after the display
+// lines that fit and continues in the next. loadChunk() lays out into pools
+// of the same size, so it fills them exactly as far as this pass did. Every
+// heading gets a TocRec, and with `words` each chunk's words also go to the
+// word log. Returns false if stopped or the book cannot be read.
+static bool indexPass(IdxCheckpoint& ck, ChunkLayout& L, WordSet* words,
+                      bool& havePgt, bool& haveWlg, bool& haveToc) {
+  File f;
+  if (!openBookText(f)) return false;
+
+  // A resumed build reopens the .pgt for update and overwrites it from the
+  // last checkpoint. Without it the index is written without a page table,
+  // which loadIndex() rejects, so the next open starts over.
+  File pgt;
+  if (ck.pagesCounted == 0) {
+    pgt = SD_MMC.open(s_pgtPath, FILE_WRITE);
+  } else if (SD_MMC.exists(s_pgtPath)) {
+    pgt = SD_MMC.open(s_pgtPath, "r+");
+    if (pgt && !pgt.seek(ck.pagesCounted * sizeof(PageRec))) pgt.close();
+  }
+  havePgt = (bool)pgt;
+
+  // The word log is only appended to; pairs logged again after a resume are
+  // dropped when the index is built.
+  File wlg;
+  if (words && ck.pagesCounted == 0) wlg = SD_MMC.open(s_wlgPath, FILE_WRITE);
+  else if (words && SD_MMC.exists(s_wlgPath)) wlg = SD_MMC.open(s_wlgPath, FILE_APPEND);
+  haveWlg = (bool)wlg;
+
+  // The .toc is resumed like the .pgt; a write error drops it for this build
+  File toc;
+  if (ck.pagesCounted == 0) {
+    toc = SD_MMC.open(s_tocPath, FILE_WRITE);
+  } else if (SD_MMC.exists(s_tocPath)) {
+    toc = SD_MMC.open(s_tocPath, "r+");
+    if (toc && !toc.seek(ck.tocCount * sizeof(TocRec))) toc.close();
+  }
+
+  // Headings go to the arena through one handle for the whole pass
+  File hdg = SD_MMC.open(s_hdgPath, FILE_APPEND);
+
+  resetLayout(L);
+  uint32_t     base            = ck.scanOffset;  // book offset of the text pool
+  LineSplitter sp              = readText(L, f, base, BOOK_END, 0);
+  int          lineCount       = 0;
+  int          sinceCheckpoint = 0;
+  bool         stopped         = false;
+
+  // Closes the chunk in L and reads the text of the next, which starts at
+  // (offset, skip).
+  auto endChunk = [&](uint32_t offset, int skip) {
+    ck.scanOffset = offset;
+    ck.scanSkip   = (uint16_t)skip;
+    if (wlg) logChunkWords(L, offset - base, (uint32_t)(s_chunkCount - 1), *words, wlg);
+    finishChunk(ck, L, pgt);
+    keepResident(L, s_chunkCount - 1);
+    resetLayout(L);
+    lineCount = 0;
+    if (s_indexStop || ++sinceCheckpoint >= CHECKPOINT_EVERY) {
+      sinceCheckpoint = 0;
+      if (pgt) pgt.flush();
+      if (wlg) wlg.flush();
+      if (toc) toc.flush();
+      saveCheckpoint(ck);
+    }
+    stopped = s_indexStop;
+    base    = offset;
+    if (!stopped) sp = readText(L, f, base, BOOK_END, 0);
+  };
+
+  // Takes the next line of the text read, trimmed and classified.
+  uint32_t    lineOffset;
+  const char* content;
+  int         clen;
+  char        st;
+  auto nextLine = [&]() {
+    size_t off, n;
+    if (!sp.next(off, n)) return false;
+    const char* line;
+    int         len;
+    trimLine(L, off, n, line, len);
+    lineOffset = base + (uint32_t)off;
+    st         = classifyLine(line, len, content, clen);
+    return true;
+  };
+
+  int skip = ck.scanSkip;  // display lines of the first line already indexed
+  while (!stopped) {
+    if (!nextLine()) {
+      // The end of the book, or of a full pool whose last line goes on past it
+      if (L.textPoolUsed < L.textPoolCap || lineCount == 0) break;
+      endChunk(base + (uint32_t)sp.position(), 0);
+      continue;
+    }
+
+    for (;;) {
+      if (lineCount == 0 && lastChunk().pageCount != 0 && !beginChunk(ck, lineOffset, skip)) {
+        stopped = true;
+        break;
+      }
+
+      int wordMark = L.wordRefsUsed;
+      int lineMark = L.displayLinesUsed, srcMark = L.sourceLinesUsed;
+      layoutSourceLine(L, content, clen, st, lineOffset, skip);
+      if (!L.overflow) break;
+
+      if (lineCount > 0) {
+        // Move the whole line to the next chunk
+        L.wordRefsUsed     = wordMark;
+        L.displayLinesUsed = lineMark;
+        L.sourceLinesUsed  = srcMark;
+        L.overflow         = false;
+        endChunk(lineOffset, skip);
+      } else {
+        int fit = L.srcLineCount[L.sourceLinesUsed - 1];
+        if (fit == 0) break;  // not even one display line fits: keep what there is
+        L.overflow = false;
+        endChunk(lineOffset, skip + fit);
+        skip += fit;
+      }
+      if (stopped) break;
+      if (!nextLine()) {  // the same line, now at the start of the text read
+        stopped = true;
+        break;
+      }
+    }
+    if (stopped) break;
+    skip = 0;
+
+    if (st == '1' || st == '2' || st == '3') {
+      // The heading's page is that of its first display line in this chunk
+      int      first = L.srcLineStart[L.sourceLinesUsed - 1];
+      char     text[64];
+      size_t   hlen  = 0;  // the heading as shown, without emphasis markers
+      forEachRun(content, (size_t)clen, [&](const char* run, size_t len, uint8_t) {
+        len = min(len, sizeof(text) - 1 - hlen);
+        memcpy(text + hlen, run, len);
+        hlen += len;
+      });
+      text[hlen] = '\0';
+
+      TocRec t;
+      memset(&t, 0, sizeof(t));
+      t.offset = lineOffset;
+      t.page   = lastChunk().firstPage + (uint32_t)(first / LINES_PER_PAGE);
+      t.level  = (uint8_t)(st - '0');
+      xSemaphoreTake(s_indexLock, portMAX_DELAY);
+      t.textOff = internHeading(hdg, text);
+      if (st == '1') {
+        // A chunk opening with the heading is listed under it
+        ck.headOff = t.textOff;
+        if (lastChunk().headingOff == 0 || lineCount == 0) lastChunk().headingOff = ck.headOff;
+      }
+      xSemaphoreGive(s_indexLock);
+      if (toc && toc.write((const uint8_t*)&t, sizeof(t)) == sizeof(t)) ck.tocCount++;
+      else if (toc) toc.close();
+    }
+
+    if (++lineCount >= LINES_PER_CHUNK) endChunk(base + (uint32_t)sp.position(), 0);
+  }
+
+  if (stopped) {
+    if (pgt) pgt.close();
+    if (wlg) wlg.close();
+    if (toc) toc.close();
+    if (hdg) hdg.close();
+    f.close();
+    return false;
+  }
+
+  // Last, partial chunk (or an empty book)
+  if (lastChunk().pageCount == 0) {
+    ck.scanOffset = base + (uint32_t)sp.position();
+    ck.scanSkip   = 0;
+    if (wlg) logChunkWords(L, ck.scanOffset - base, (uint32_t)(s_chunkCount - 1), *words, wlg);
+    finishChunk(ck, L, pgt);
+    keepResident(L, s_chunkCount - 1);
+  }
+  f.close();
+  if (pgt) pgt.close();
+  if (wlg) wlg.close();
+  if (hdg) hdg.close();
+  haveToc = (bool)toc;
+  if (toc) toc.close();
+  return true;
+}
+
+// Turns the word log into <book>.wix. Each pass reads the log and sorts the
+// pairs of as many buckets as fit one buffer, so memory stays bounded
+// however large the book; with PSRAM one or two passes do. Gives up, leaving
+// no word index, if memory is short, a write fails or the book is closed.
+static bool buildWordIndex(const IdxHeader& idx) {
+  File log = SD_MMC.open(s_wlgPath, FILE_READ);
+  if (!log) return false;
+  const size_t BLOCK = 512;  // pairs per log read
+  WixBucket* dir   = (WixBucket*)allocLarge(WIX_BUCKETS * sizeof(WixBucket));
+  WordPair*  block = (WordPair*)allocLarge(BLOCK * sizeof(WordPair));
+  WordPair*  pairs = nullptr;
+  File       out;
+  bool       ok    = dir && block;
+
+  // dir[b].count holds bucket b's pair count until the bucket is written
+  size_t largest = 1;
+  if (ok) {
+    memset(dir, 0, WIX_BUCKETS * sizeof(WixBucket));
+    size_t got;
+    while ((got = log.read((uint8_t*)block, BLOCK * sizeof(WordPair)) / sizeof(WordPair)) > 0)
+      for (size_t i = 0; i < got; i++) dir[wixBucket(block[i].hash)].count++;
+    for (int b = 0; b < WIX_BUCKETS; b++) largest = max(largest, (size_t)dir[b].count);
+  }
+  size_t cap = min(max(log.size() / sizeof(WordPair), largest), (size_t)WIX_PASS_MAX_PAIRS);
+  while (ok && cap >= largest && !(pairs = (WordPair*)allocLarge(cap * sizeof(WordPair))))
+    cap /= 2;
+  ok = ok && pairs;
+
+  WixHeader hdr;
+  memset(&hdr, 0, sizeof(hdr));  // magic 0 until the index is complete
+  if (ok) {
+    out = SD_MMC.open(s_wixPath, FILE_WRITE);
+    ok  = out && out.write((const uint8_t*)&hdr, sizeof(hdr)) == sizeof(hdr) &&
+          out.write((const uint8_t*)dir, WIX_BUCKETS * sizeof(WixBucket)) ==
+              WIX_BUCKETS * sizeof(WixBucket);
+  }
+
+  uint32_t off = sizeof(WixHeader) + WIX_BUCKETS * sizeof(WixBucket);
+  for (int lo = 0, hi; ok && lo < WIX_BUCKETS; lo = hi) {
+    size_t n = 0;
+    for (hi = lo; hi < WIX_BUCKETS && n + dir[hi].count <= cap; hi++) n += dir[hi].count;
+
+    n = 0;
+    log.seek(0);
+    size_t got;
+    while ((got = log.read((uint8_t*)block, BLOCK * sizeof(WordPair)) / sizeof(WordPair)) > 0) {
+      for (size_t i = 0; i < got; i++) {
+        int b = wixBucket(block[i].hash);
+        if (b >= lo && b < hi && n < cap) pairs[n++] = block[i];
+      }
+    }
+    n = sortWordPairs(pairs, n);
+    uint32_t wrote = wixWriteBuckets(out, pairs, n, off, lo, hi, dir);
+    ok   = (n == 0 || wrote > 0) && !s_indexStop;
+    off += wrote;
+    for (int b = lo; b < hi; b++) hdr.wordCount += dir[b].count;
+  }
+
+  if (ok) {
+    hdr.magic      = WIX_MAGIC;
+    hdr.version    = WIX_VERSION;
+    hdr.headerSize = sizeof(WixHeader);
+    hdr.bookSize   = idx.bookSize;
+    hdr.bookMtime  = idx.bookMtime;
+    hdr.layoutHash = idx.layoutHash;
+    hdr.chunkCount = idx.chunkCount;
+    ok = out.seek(sizeof(WixHeader)) &&
+         out.write((const uint8_t*)dir, WIX_BUCKETS * sizeof(WixBucket)) ==
+             WIX_BUCKETS * sizeof(WixBucket) &&
+         out.seek(0) && out.write((const uint8_t*)&hdr, sizeof(hdr)) == sizeof(hdr);
+  }
+  if (out) out.close();
+  log.close();
+  heap_caps_free(pairs);
+  heap_caps_free(block);
+  heap_caps_free(dir);
+
+  SD_MMC.remove(s_wlgPath);
+  if (!ok) SD_MMC.remove(s_wixPath);
+  else ESP_LOGI(TAG, "Word index for %s: %u words", s_bookDisplayName, (unsigned)hdr.wordCount);
+  return ok;
+}
+
+// True if <book>.wix was built from the index described by idx.
+static bool wordIndexMatches(const IdxHeader& idx) {
+  if (!SD_MMC.exists(s_wixPath)) return false;
+  File f = SD_MMC.open(s_wixPath, FILE_READ);
+  if (!f) return false;
+  WixHeader hdr;
+  bool ok = f.read((uint8_t*)&hdr, sizeof(hdr)) == sizeof(hdr) && hdr.magic == WIX_MAGIC &&
+            hdr.version == WIX_VERSION && hdr.headerSize == sizeof(WixHeader) &&
+            hdr.bookSize == idx.bookSize && hdr.bookMtime == idx.bookMtime &&
+            hdr.layoutHash == idx.layoutHash && hdr.chunkCount == idx.chunkCount;
+  f.close();
+  return ok;
+}
+
+static void indexTask(void* parameter) {
+  ChunkPools* pools = (ChunkPools*)heap_caps_malloc(sizeof(ChunkPools), MALLOC_CAP_SPIRAM);
+  if (!pools) pools = (ChunkPools*)heap_caps_malloc(sizeof(ChunkPools), MALLOC_CAP_8BIT);
+
+  // The word index is optional: without memory for its table, none is built
+  uint32_t* wordSlots = (uint32_t*)allocLarge(WORD_SET_SLOTS * sizeof(uint32_t));
+
+  bool done    = false;
+  bool havePgt = false;
+  bool haveWlg = false;
+  bool haveToc = false;
+  if (pools) {
+    ChunkLayout scratch;
+    bindLayout(scratch, *pools);
+    if (wordSlots) {
+      WordSet words(wordSlots, WORD_SET_SLOTS);
+      done = indexPass(s_ick, scratch, &words, havePgt, haveWlg, haveToc);
+    } else {
+      done = indexPass(s_ick, scratch, nullptr, havePgt, haveWlg, haveToc);
+    }
+    heap_caps_free(pools);
+  } else {
+    ESP_LOGE(TAG, "No memory to index %s", s_bookDisplayName);
+  }
+
+  s_scanning  = false;
+  int pending = s_pendingChunk;
+  int n       = chunkCount();
+  if (pending >= n) s_pendingChunk = n - 1;  // bookmark past the end of an edited book
+  needsRedraw = true;
+
+  if (done) {
+    // The header goes in last: until then chunkCount is 0 and loadIndex()
+    // rejects the file.
+    IdxHeader hdr    = s_ick.hdr;
+    hdr.chunkCount   = (uint32_t)s_chunkCount;
+    hdr.headingBytes = s_headingBytes;
+    hdr.totalPages   = s_ick.pagesCounted;
+    hdr.tocCount     = haveToc ? s_ick.tocCount : 0;
+
+    xSemaphoreTake(s_indexLock, portMAX_DELAY);
+    bool written = writeChunkRecs(s_tailBase, s_recTail, s_chunkCount - s_tailBase, &hdr);
+    xSemaphoreGive(s_indexLock);
+    if (written) SD_MMC.remove(s_ickPath);
+    s_totalPages   = (int)hdr.totalPages;
+    s_hasPageTable = havePgt;
+    s_tocCount     = written ? (int)hdr.tocCount : 0;
+    s_oledDirty    = true;
+    if (written && haveWlg) s_hasWordIndex = buildWordIndex(hdr);
+  }
+  heap_caps_free(wordSlots);
+
+  s_indexing    = false;
+  s_indexHandle = NULL;
+  vTaskDelete(NULL);
+}
+
+// Deletes every <book>.lyc record when the index is rebuilt: their chunk
+// spans belong to the old index, and records past the new chunk count would
+// never be overwritten.
+static void clearLayoutCache() {
+  File dir = SD_MMC.open(s_lycDir);
+  if (!dir || !dir.isDirectory()) return;
+  char path[112];
+  File entry = dir.openNextFile();
+  while (entry) {
+    const char* full  = entry.name();
+    const char* slash = strrchr(full, '/');
+    snprintf(path, sizeof(path), "%s/%s", s_lycDir, slash ? slash + 1 : full);
+    entry.close();
+    SD_MMC.remove(path);
+    entry = dir.openNextFile();
+  }
+  dir.close();
+}
+
+// Starts building <book>.idx and <book>.pgt in the background, resuming from
+// <book>.ick when a previous build was interrupted. On return chunk 0 (and
+// any chunks and page counts restored from the checkpoint) can be used.
+// Returns false if the book cannot be opened or the index files cannot be
+// created; nothing is started then.
+static bool startIndexing() {
+  clearIndex();
+  File f = SD_MMC.open(s_bookPath, FILE_READ);
+  if (!f) {
+    fileError = true;
+    return false;
+  }
+
+  IdxHeader stamp;
+  memset(&stamp, 0, sizeof(stamp));
+  stamp.magic      = IDX_MAGIC;
+  stamp.version    = IDX_VERSION;
+  stamp.headerSize = sizeof(IdxHeader);
+  stamp.bookSize   = (uint32_t)f.size();
+  stamp.bookMtime  = (uint32_t)f.getLastWrite();
+  stamp.layoutHash = layoutParamHash();
+  f.close();
+
+  if (!SD_MMC.exists(BMARKS_DIR)) SD_MMC.mkdir(BMARKS_DIR);
+  if (loadCheckpoint(s_ick, stamp)) {
+    ESP_LOGI(TAG, "Resuming index of %s at byte %u, chunk %d", s_bookDisplayName,
+             (unsigned)s_ick.scanOffset, s_chunkCount);
+  } else {
+    clearLayoutCache();
+
+    // Fresh .idx with an empty header and an arena holding only ""
+    File idx = SD_MMC.open(s_idxPath, FILE_WRITE);
+    File hdg = SD_MMC.open(s_hdgPath, FILE_WRITE);
+    bool ok  = idx && hdg && idx.write((const uint8_t*)&stamp, sizeof(stamp)) == sizeof(stamp) &&
+               hdg.write((uint8_t)0) == 1;
+    if (idx) idx.close();
+    if (hdg) hdg.close();
+    if (!ok) {
+      ESP_LOGE(TAG, "Cannot create index files for %s", s_bookDisplayName);
+      return false;
+    }
+
+    memset(&s_ick, 0, sizeof(s_ick));
+    s_ick.hdr = stamp;
+    memset(&s_recTail[0], 0, sizeof(ChunkRec));
+    s_chunkCount   = 1;
+    s_headingBytes = 1;
+  }
+
+  s_stamp     = stamp;
+  s_indexStop = false;
+  s_scanning  = true;
+  s_indexing  = true;
+  xTaskCreatePinnedToCore(indexTask,             // Function name
+                          "bookIndexTask",       // Task name
+                          6144,                  // Stack size
+                          NULL,                  // Parameters
+                          tskIDLE_PRIORITY,      // Priority (below einkHandler)
+                          &s_indexHandle,        // Task handle
+                          0);                    // Core ID (shared with einkHandler)
+  return true;
+}
+
+// Checkpoints and ends a running build; call before leaving the reader.
+static void stopIndexing() {
+  if (!s_indexing) return;
+  s_indexStop = true;
+  while (s_indexing) vTaskDelay(pdMS_TO_TICKS(10));
+}
+
+// Checks <book>.idx and loads the tail page of its records; the rest are
+// paged in on demand. Returns false (and leaves the index empty) if the file
+// is missing, unfinished, from another format version, stale, or inconsistent
+// with the heading arena or page table. An index is stale when the book's
+// size or mtime differ from the ones it was built from (book replaced over
+// USB) or layoutParamHash() changed (firmware with other fonts or layout
+// constants).
+static bool loadIndex() {
+  clearIndex();
+  if (!SD_MMC.exists(s_idxPath) || !SD_MMC.exists(s_hdgPath)) return false;
+
+  File book = SD_MMC.open(s_bookPath, FILE_READ);
+  if (!book) return false;
+  uint32_t bookSize  = (uint32_t)book.size();
+  uint32_t bookMtime = (uint32_t)book.getLastWrite();
+  book.close();
+
+  File f = SD_MMC.open(s_idxPath, FILE_READ);
+  if (!f) return false;
+
+  IdxHeader hdr;
+  bool ok = f.read((uint8_t*)&hdr, sizeof(hdr)) == sizeof(hdr) &&
+            hdr.magic == IDX_MAGIC && hdr.version == IDX_VERSION &&
+            hdr.headerSize == sizeof(IdxHeader) && hdr.chunkCount > 0 && hdr.headingBytes > 0 &&
+            f.size() == sizeof(hdr) + (size_t)hdr.chunkCount * sizeof(ChunkRec);
+  if (ok && (hdr.bookSize != bookSize || hdr.bookMtime != bookMtime ||
+             hdr.layoutHash != layoutParamHash())) {
+    ESP_LOGI(TAG, "Index for %s is stale, rebuilding", s_bookDisplayName);
+    ok = false;
+  }
+  int base = ok ? tailBaseFor((int)hdr.chunkCount) : 0;
+  if (ok) {
+    size_t tailBytes = (hdr.chunkCount - base) * sizeof(ChunkRec);
+    ok = f.seek(sizeof(hdr) + (uint32_t)base * sizeof(ChunkRec)) &&
+         f.read((uint8_t*)s_recTail, tailBytes) == tailBytes;
+  }
+  f.close();
+
+  // Records are written in order, so the last one accounts for every page
+  if (ok) {
+    const ChunkRec& last = s_recTail[hdr.chunkCount - 1 - base];
+    ok = last.pageCount > 0 && last.firstPage + last.pageCount == hdr.totalPages;
+  }
+  if (ok) {
+    File hdg = SD_MMC.open(s_hdgPath, FILE_READ);
+    ok = hdg && hdg.size() == hdr.headingBytes;
+    if (hdg) hdg.close();
+  }
+  if (ok) {
+    s_chunkCount   = (int)hdr.chunkCount;
+    s_tailBase     = base;
+    s_headingBytes = hdr.headingBytes;
+    s_totalPages   = (int)hdr.totalPages;
+    s_hasWordIndex = wordIndexMatches(hdr);
+    s_stamp        = hdr;
+  }
+
+  // A missing or short .toc only costs the table of contents
+  if (ok && hdr.tocCount > 0 && SD_MMC.exists(s_tocPath)) {
+    File toc = SD_MMC.open(s_tocPath, FILE_READ);
+    if (toc) {
+      if (toc.size() == (size_t)hdr.tocCount * sizeof(TocRec)) s_tocCount = (int)hdr.tocCount;
+      toc.close();
+    }
+  }
+
+  // Page table must cover every page, otherwise it predates this index
+  if (ok && SD_MMC.exists(s_pgtPath)) {
+    File pgt = SD_MMC.open(s_pgtPath, FILE_READ);
+    if (pgt) {
+      s_hasPageTable = pgt.size() == (size_t)s_totalPages * sizeof(PageRec);
+      pgt.close();
+    }
+  }
+
+  if (!ok || !s_hasPageTable) {
+    clearIndex();
+    return false;
+  }
+  return true;
+}
+
+// Without an index only chunk 0 could be reached, so a book whose index
+// cannot be built is refused rather than shown cut short.
+static bool buildOrLoadIndex() {
+  if (!loadIndex() && !startIndexing()) {
+    if (!fileError) indexError = true;
+    return false;
+  }
+  if (s_chunkCount == 0) {
+    memset(&s_recTail[0], 0, sizeof(ChunkRec));
+    s_chunkCount = 1;
+  }
+  return true;
+}
+
+// ── Layout cache ──────────────────────────────────────────────────────────────
+// <book>.lyc/<chunk> keeps a chunk's finished layout, so loading it again is
+// one SD read instead of parsing and measuring its text: a LycHeader, the
+// used part of each pool in LayoutPools order, then the text its words point
+// into. A record is written the first time loadChunk() lays the chunk out,
+// and only used if it was made for the same book, layout parameters and
+// chunk span. A resident book does without: it lays out from RAM and keeps
+// the result.
+#define LYC_MAGIC   0x3143594C  // "LYC1"
+#define LYC_VERSION 1
+
+struct LycHeader {
+  uint32_t magic;       // 0 until the record is complete
+  uint16_t version;
+  uint16_t headerSize;  // sizeof(LycHeader) when written
+  uint32_t bookSize;    // s_stamp when written
+  uint32_t bookMtime;
+  uint32_t layoutHash;
+  uint32_t start;       // the chunk's ChunkSpan
+  uint32_t end;
+  uint16_t startSkip;
+  uint16_t endSkip;
+  uint16_t words;       // pool entries that follow
+  uint16_t lines;
+  uint16_t srcs;
+  uint16_t listStart;
+  uint32_t textLen;
+};
+static_assert(sizeof(LycHeader) == 44, "LycHeader is stored on SD as-is");
+
+// Record size for the pools in h: a word takes 5 bytes, a display line 4 and
+// a source line 8.
+static size_t lycSize(const LycHeader& h) {
+  return sizeof(LycHeader) + (size_t)h.words * 5 + (size_t)h.lines * 4 + (size_t)h.srcs * 8 +
+         h.textLen;
+}
+
+static bool lycMatches(const LycHeader& h, const ChunkSpan& span) {
+  return h.magic == LYC_MAGIC && h.version == LYC_VERSION && h.headerSize == sizeof(LycHeader) &&
+         h.bookSize == s_stamp.bookSize && h.bookMtime == s_stamp.bookMtime &&
+         h.layoutHash == s_stamp.layoutHash && h.start == span.start && h.end == span.end &&
+         h.startSkip == span.startSkip && h.endSkip == span.endSkip;
+}
+
+// Restores chunk idx into L from its record, reading each pool straight
+// into L once the header has been checked. Returns false if there is no
+// usable record; L is then left to be laid out again.
+static bool restoreLayout(ChunkLayout& L, int idx, const ChunkSpan& span) {
+  char path[112];
+  snprintf(path, sizeof(path), "%s/%d", s_lycDir, idx);
+  if (s_stamp.magic != IDX_MAGIC || !SD_MMC.exists(path)) return false;
+  File f = SD_MMC.open(path, FILE_READ);
+  if (!f) return false;
+
+  LycHeader h;
+  bool ok = f.read((uint8_t*)&h, sizeof(h)) == sizeof(h) && lycMatches(h, span) &&
+            f.size() == lycSize(h) && h.words <= L.wordRefsCap &&
+            h.lines <= L.displayLinesCap && h.srcs <= L.sourceLinesCap &&
+            h.textLen <= (uint32_t)L.textPoolCap;
+  if (ok) {
+    auto take = [&](void* p, size_t n) { return f.read((uint8_t*)p, n) == n; };
+    resetLayout(L);
+    ok = take(L.srcOffset, h.srcs * sizeof(uint32_t)) &&
+         take(L.wordOff, h.words * sizeof(uint16_t)) &&
+         take(L.wordPos, h.words * sizeof(uint16_t)) &&
+         take(L.lineWordStart, h.lines * sizeof(uint16_t)) &&
+         take(L.srcLineStart, h.srcs * sizeof(uint16_t)) && take(L.wordLen, h.words) &&
+         take(L.lineWordCount, h.lines) && take(L.lineBaseline, h.lines) &&
+         take(L.srcLineCount, h.srcs) && take(L.srcStyle, h.srcs) &&
+         take(L.textPool, h.textLen);
+  }
+  f.close();
+  if (ok) {
+    L.wordRefsUsed     = h.words;
+    L.displayLinesUsed = h.lines;
+    L.sourceLinesUsed  = h.srcs;
+    L.listStart        = h.listStart;
+    L.textPoolUsed     = (int)h.textLen;
+  }
+  return ok;
+}
+
+// Writes chunk idx, laid out in L by loadChunk(), to its record. A failed
+// write leaves no record.
+static void saveLayout(const ChunkLayout& L, int idx, const ChunkSpan& span) {
+  if (s_stamp.magic != IDX_MAGIC) return;
+  if (!SD_MMC.exists(s_lycDir)) SD_MMC.mkdir(s_lycDir);
+  char path[112];
+  snprintf(path, sizeof(path), "%s/%d", s_lycDir, idx);
+  File f = SD_MMC.open(path, FILE_WRITE);
+  if (!f) return;
+
+  // Only the text the words use; a pool read past the chunk's end holds more
+  uint32_t textLen = 0;
+  for (int i = 0; i < L.wordRefsUsed; i++)
+    textLen = max(textLen, (uint32_t)L.wordOff[i] + L.wordLen[i]);
+
+  LycHeader h;
+  memset(&h, 0, sizeof(h));
+  h.version    = LYC_VERSION;
+  h.headerSize = sizeof(LycHeader);
+  h.bookSize   = s_stamp.bookSize;
+  h.bookMtime  = s_stamp.bookMtime;
+  h.layoutHash = s_stamp.layoutHash;
+  h.start      = span.start;
+  h.end        = span.end;
+  h.startSkip  = span.startSkip;
+  h.endSkip    = span.endSkip;
+  h.words      = (uint16_t)L.wordRefsUsed;
+  h.lines      = (uint16_t)L.displayLinesUsed;
+  h.srcs       = (uint16_t)L.sourceLinesUsed;
+  h.listStart  = L.listStart;
+  h.textLen    = textLen;
+
+  auto put = [&](const void* p, size_t n) { return f.write((const uint8_t*)p, n) == n; };
+  bool ok  = put(&h, sizeof(h)) && put(L.srcOffset, h.srcs * sizeof(uint32_t)) &&
+             put(L.wordOff, h.words * sizeof(uint16_t)) &&
+             put(L.wordPos, h.words * sizeof(uint16_t)) &&
+             put(L.lineWordStart, h.lines * sizeof(uint16_t)) &&
+             put(L.srcLineStart, h.srcs * sizeof(uint16_t)) && put(L.wordLen, h.words) &&
+             put(L.lineWordCount, h.lines) && put(L.lineBaseline, h.lines) &&
+             put(L.srcLineCount, h.srcs) && put(L.srcStyle, h.srcs) &&
+             put(L.textPool, textLen);
+  if (ok) {
+    h.magic = LYC_MAGIC;
+    ok      = f.seek(0) && put(&h, sizeof(h));
+  }
+  f.close();
+  if (!ok) SD_MMC.remove(path);
+}
+
+// ── Chunk loading ──────────────────────────────────────────────────────────────
+// Reads the book from `start` into L's text pool and lays its lines out until
+// the chunk end (end, endSkip), the end of what was read, a full pool, or —
+// when minLines > 0 — until L holds minLines display lines. The first line
+// drops its leading `skip` display lines; if it is a list item, its number
+// is `listNum`.
+static void layoutLines(ChunkLayout& L, File& f, uint32_t start, uint32_t end, int endSkip,
+                        uint16_t listNum, int skip, int minLines) {
+  L.listStart            = listNum;
+  LineSplitter sp        = readText(L, f, start, end, endSkip);
+  int          lineCount = 0;
+  size_t       off, n;
+
+  for (;;) {
+    uint32_t pos   = start + (uint32_t)sp.position();
+    int      limit = -1;
+    if (pos >= end) {
+      if (pos > end || endSkip == 0) break;
+      limit = endSkip;  // the chunk ends inside this line
+    }
+    if (lineCount >= L.sourceLinesCap || L.overflow) break;
+    if (minLines > 0 && L.displayLinesUsed >= minLines) break;
+    if (!sp.next(off, n)) break;
+
+    const char* line;
+    int         len;
+    trimLine(L, off, n, line, len);
+    const char* content;
+    int         clen;
+    char        st = classifyLine(line, len, content, clen);
+
+    layoutSourceLine(L, content, clen, st, pos, skip, limit);
+    skip = 0;
+    lineCount++;
+    if (limit >= 0) break;
+  }
+}
+
+// Lays chunk `idx` out into L, from its layout cache record if it has one,
+// else from one read of its text. Returns false if the book file cannot be
+// opened.
+static bool loadChunk(ChunkLayout& L, int idx) {
+  ChunkSpan span;
+  if (!chunkSpan(idx, span)) return false;
+  bool useCache = !s_bookText;
+  if (useCache && restoreLayout(L, idx, span)) return true;
+
+  File f;
+  if (!openBookText(f)) return false;
+
+  resetLayout(L);
+  layoutLines(L, f, span.start, span.end, span.endSkip, 1, span.startSkip, 0);
+  f.close();
+
+  if (L.sourceLinesUsed == 0) layoutEmpty(L, span.start);
+  if (useCache) saveLayout(L, idx, span);
+
+  return true;
+}
+
+// Lays out just the screen starting at `globalPage` into L (page-view pools)
+// by seeking to its page-table record. Rendered with startLine = 0.
+static bool layoutPage(ChunkLayout& L, int globalPage) {
+  PageRec   pr;
+  ChunkSpan span;
+  if (!readPageRec(globalPage, pr) || !chunkSpan(pr.chunk, span)) return false;
+
+  File f;
+  if (!openBookText(f)) return false;
+
+  resetLayout(L);
+  layoutLines(L, f, pr.offset, span.end, span.endSkip, pr.listNum, pr.skip, PAGE_VIEW_LINES);
+  f.close();
+
+  L.chunk = pr.chunk;
+  return true;
+}
+
+static bool layoutPageView(int globalPage) {
+  if (s_pageViewPage == globalPage) return true;
+  s_pageViewPage = -1;
+  if (!layoutPage(s_pageView, globalPage)) return false;
+  s_pageViewPage = globalPage;
+  return true;
+}
+
+// ── Document rendering ────────────────────────────────────────────────────────
+// Draws onto any GFX target: the display, or a page raster for the cache below.
+static int renderSourceLine(Adafruit_GFX& g, const ChunkLayout& L, ulong startLine, int si,
+                            int startX, int startY) {
+  char style     = L.srcStyle[si];
+  int  lineStart = L.srcLineStart[si];
+  int  lineEnd   = lineStart + L.srcLineCount[si];
+
+  if (lineEnd > lineStart && (ulong)(lineEnd - 1) < startLine) return 0;
+
+  if (style == 'H') {
+    g.drawFastHLine(0, startY + 3, g.width(), GxEPD_BLACK);
+    g.drawFastHLine(0, startY + 4, g.width(), GxEPD_BLACK);
+    return 8;
+  }
+  if (style == 'B') return 12;
+
+  int drawX = startX;
+  if (style == '>')
+    drawX += SPECIAL_PADDING;
+  else if (style == '-' || style == 'L')
+    drawX += 2 * SPECIAL_PADDING;
+  else if (style == 'C')
+    drawX += SPECIAL_PADDING / 2;
+
+  int            cursorY  = startY;
+  const GFXfont* lastFont = nullptr;
+
+  for (int li = max(lineStart, (int)startLine); li < lineEnd; li++) {
+    int baseline  = L.lineBaseline[li];
+    int wordStart = L.lineWordStart[li];
+    for (int wi = wordStart; wi < wordStart + L.lineWordCount[li]; wi++) {
+      uint16_t       pos   = L.wordPos[wi];
+      uint8_t        flags = pos >> WORD_FLAG_SHIFT;
+      const GFXfont* font  = pickFont(style, flags & RUN_BOLD, flags & RUN_ITALIC, flags & RUN_CODE);
+      if (font != lastFont) g.setFont(lastFont = font);
+      g.setCursor(drawX + (pos & WORD_X_MASK), cursorY + baseline);
+      g.write((const uint8_t*)L.textPool + L.wordOff[wi], L.wordLen[wi]);
+    }
+
+    uint8_t pad = (style == '1' || style == '2' || style == '3') ? HEADING_LINE_PADDING
+                                                                  : NORMAL_LINE_PADDING;
+    cursorY += baseline + (int)pad;
+  }
+
+  if (style == '>') {
+    g.drawFastVLine(SPECIAL_PADDING / 2, startY, cursorY - startY, GxEPD_BLACK);
+    g.drawFastVLine(SPECIAL_PADDING / 2 + 1, startY, cursorY - startY, GxEPD_BLACK);
+  } else if (style == 'C') {
+    g.drawFastVLine(SPECIAL_PADDING / 4, startY, cursorY - startY, GxEPD_BLACK);
+    g.drawFastVLine(SPECIAL_PADDING / 4 + 1, startY, cursorY - startY, GxEPD_BLACK);
+    g.drawFastVLine(g.width() - SPECIAL_PADDING / 4, startY, cursorY - startY, GxEPD_BLACK);
+    g.drawFastVLine(g.width() - SPECIAL_PADDING / 4 - 1, startY, cursorY - startY, GxEPD_BLACK);
+  } else if (style == '1' || style == '2' || style == '3') {
+    g.drawFastHLine(0, cursorY - 2, g.width(), GxEPD_BLACK);
+    g.drawFastHLine(0, cursorY - 3, g.width(), GxEPD_BLACK);
+  } else if (style == '-') {
+    g.fillCircle(drawX - 8, startY + 8, 3, GxEPD_BLACK);
+  } else if (style == 'L') {
+    char num[16];
+    snprintf(num, sizeof(num), "%lu. ", listNumber(L, si));
+    FontMetrics fm(pickFont('T', false, false));
+    g.setFont(fm.font());
+    g.setCursor(drawX - fm.advance(num) - 5, startY + fm.height(num));
+    g.print(num);
+  }
+
+  return cursorY - startY;
+}
+
+static void renderDocument(Adafruit_GFX& g, const ChunkLayout& L, ulong startLine, int startX,
+                           int startY) {
+  int cursorY = startY;
+  for (int si = 0; si < L.sourceLinesUsed; si++) {
+    if (cursorY >= g.height() - 6) break;
+    cursorY += renderSourceLine(g, L, startLine, si, startX, cursorY);
+  }
+}
+
+// The reading screen: chunk's heading over the page of L that starts at
+// display line startLine.
+static void renderPage(Adafruit_GFX& g, const ChunkLayout& L, ulong startLine, int chunk) {
+  g.setTextColor(GxEPD_BLACK);
+  g.setFont(&Font5x7Fixed);
+  String header = chunkHeading(chunk);
+  if (header.length() == 0) header = String(s_bookDisplayName);
+  if ((int)header.length() > 44) header = header.substring(0, 43) + "~";
+  g.setCursor(4, 11);
+  g.print(header);
+  g.drawFastHLine(0, 14, g.width(), GxEPD_BLACK);
+
+  renderDocument(g, L, startLine, 4, CONTENT_START_Y);
+}
+
+// ── Page raster cache ─────────────────────────────────────────────────────────
+// Optional ('r' in reading mode, kept in prefs as "BookRaster"). Each page is
+// drawn once into a 1-bpp raster the size of the screen and kept in
+// <book>.ras, so showing it again is one SD read and a copy into the display
+// buffer, with no layout or glyph drawing. The file is a RasHeader stamped
+// like the index, then a slot per global page: a tag, then the raster. The
+// tag is written last, and a slot never written holds no valid tag. While no
+// key has been pressed for RASTER_IDLE_MS, or the device is charging, a task
+// renders the pages after the one on screen into the file: RASTER_AHEAD of
+// them, or on the charger the rest of the book.
+//
+// Independently of that mode, the last RASTER_RING_PAGES pages shown stay in
+// a ring of rasters in RAM (PSRAM when present, fewer slots if memory is
+// short), so paging back or flipping between two pages is a buffer copy.
+//
+// And as soon as a page is shown, the same task draws the next one (and with
+// SPECULATE_PREV the one before) into a shadow raster, so pressing > usually
+// only swaps rasters before the panel refresh. Each shown page bumps
+// s_specGen; a speculative page drawn for an older one is dropped unused.
+#define RAS_MAGIC   0x31534152  // "RAS1"
+#define RAS_VERSION 1
+
+struct RasHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t headerSize;  // sizeof(RasHeader) when written
+  uint32_t bookSize;    // s_stamp when written
+  uint32_t bookMtime;
+  uint32_t layoutHash;
+  uint16_t width;       // raster size in pixels
+  uint16_t height;
+};
+static_assert(sizeof(RasHeader) == 24, "RasHeader is stored on SD as-is");
+
+static bool              s_rasterOn     = false;    // pages go through the cache
+static volatile bool     s_rasterReady  = false;    // <book>.ras matches s_stamp
+static GFXcanvas1*       s_raster       = nullptr;  // the e-ink task's page raster
+static int               s_rasterPage   = -1;       // global page held by s_raster
+static int               s_viewPage     = -1;       // page resolveView() set up, -1 = uncached
+static volatile int      s_rasterFrom   = -1;       // first page to render ahead, -1 = none
+static volatile ulong    s_lastKeyMs    = 0;
+static SemaphoreHandle_t s_rasterLock   = NULL;     // one task at a time in <book>.ras
+static TaskHandle_t      s_rasterHandle = NULL;
+static uint8_t*          s_ringBuf      = nullptr;  // s_ringSlots rasters back to back
+static int               s_ringPage[RASTER_RING_PAGES];  // global page per slot, -1 = free
+static int               s_ringSlots    = 0;
+static int               s_ringNext     = 0;        // slot reused next, the oldest
+static GFXcanvas1*       s_shadow[2]    = {nullptr, nullptr};  // next and previous page
+static volatile int      s_shadowPage[2] = {-1, -1};           // page each holds, -1 = none
+static volatile uint32_t s_specGen      = 0;        // bumped each time a page is shown
+static SemaphoreHandle_t s_shadowLock   = NULL;     // guards s_shadow and s_shadowPage
+
+static size_t rasterBytes() { return (size_t)(display.width() + 7) / 8 * display.height(); }
+
+static uint32_t rasSlot(int page) {
+  return sizeof(RasHeader) + (uint32_t)page * (uint32_t)(sizeof(uint32_t) + rasterBytes());
+}
+
+// Differs per book and layout, so a slot left over from another file's
+// clusters is never taken for this one's.
+static uint32_t rasTag(int page) {
+  return (RAS_MAGIC ^ s_stamp.bookMtime ^ s_stamp.layoutHash) + (uint32_t)page;
+}
+
+// Checks <book>.ras against the index, starting it afresh if it was made for
+// another book, layout or screen. Nothing is cached until this succeeds.
+static bool openRasterCache() {
+  if (s_rasterReady) return true;
+  if (s_stamp.magic != IDX_MAGIC) return false;
+
+  RasHeader want;
+  memset(&want, 0, sizeof(want));
+  want.magic      = RAS_MAGIC;
+  want.version    = RAS_VERSION;
+  want.headerSize = sizeof(RasHeader);
+  want.bookSize   = s_stamp.bookSize;
+  want.bookMtime  = s_stamp.bookMtime;
+  want.layoutHash = s_stamp.layoutHash;
+  want.width      = (uint16_t)display.width();
+  want.height     = (uint16_t)display.height();
+
+  bool ok = false;
+  xSemaphoreTake(s_rasterLock, portMAX_DELAY);
+  if (SD_MMC.exists(s_rasPath)) {
+    RasHeader h;
+    File      f = SD_MMC.open(s_rasPath, FILE_READ);
+    ok = f && f.read((uint8_t*)&h, sizeof(h)) == sizeof(h) && memcmp(&h, &want, sizeof(h)) == 0;
+    if (f) f.close();
+  }
+  if (!ok) {
+    File f = SD_MMC.open(s_rasPath, FILE_WRITE);  // drops every cached page
+    ok = f && f.write((const uint8_t*)&want, sizeof(want)) == sizeof(want);
+    if (f) f.close();
+  }
+  xSemaphoreGive(s_rasterLock);
+  s_rasterReady = ok;
+  return ok;
+}
+
+// Reads the raster of global page `page` into buf, or with buf null only
+// checks that it is cached.
+static bool readRaster(int page, uint8_t* buf) {
+  if (!s_rasterOn || !s_rasterReady) return false;
+  size_t   n   = rasterBytes();
+  uint32_t tag = 0;
+  xSemaphoreTake(s_rasterLock, portMAX_DELAY);
+  File f  = SD_MMC.open(s_rasPath, FILE_READ);
+  bool ok = f && f.size() >= rasSlot(page + 1) && f.seek(rasSlot(page)) &&
+            f.read((uint8_t*)&tag, sizeof(tag)) == sizeof(tag) && tag == rasTag(page) &&
+            (!buf || f.read(buf, n) == n);
+  if (f) f.close();
+  xSemaphoreGive(s_rasterLock);
+  return ok;
+}
+
+static bool writeRaster(int page, const uint8_t* buf) {
+  if (!s_rasterOn || !s_rasterReady) return false;
+  size_t   n   = rasterBytes();
+  uint32_t tag = rasTag(page);
+  xSemaphoreTake(s_rasterLock, portMAX_DELAY);
+  File f  = SD_MMC.open(s_rasPath, "r+");
+  bool ok = f && f.seek(rasSlot(page) + sizeof(tag)) && f.write(buf, n) == n &&
+            f.seek(rasSlot(page)) && f.write((const uint8_t*)&tag, sizeof(tag)) == sizeof(tag);
+  if (f) f.close();
+  xSemaphoreGive(s_rasterLock);
+  return ok;
+}
+
+// Read by the raster task too, to skip a page that is already at hand; a
+// stale answer only costs a redundant render.
+static bool ringHas(int page) {
+  for (int i = 0; i < s_ringSlots; i++)
+    if (s_ringPage[i] == page) return true;
+  return false;
+}
+
+static bool ringGet(int page, uint8_t* dst) {
+  size_t n = rasterBytes();
+  for (int i = 0; i < s_ringSlots; i++) {
+    if (s_ringPage[i] != page) continue;
+    memcpy(dst, s_ringBuf + i * n, n);
+    return true;
+  }
+  return false;
+}
+
+static void ringPut(int page, const uint8_t* src) {
+  if (s_ringSlots == 0) return;
+  size_t n    = rasterBytes();
+  int    slot = s_ringNext;
+  for (int i = 0; i < s_ringSlots; i++)
+    if (s_ringPage[i] == page) slot = i;
+  if (slot == s_ringNext) s_ringNext = (s_ringNext + 1) % s_ringSlots;
+  memcpy(s_ringBuf + slot * n, src, n);
+  s_ringPage[slot] = page;
+}
+
+// The e-ink task's raster, allocated on first use; null without memory.
+static GFXcanvas1* rasterCanvas() {
+  if (!s_raster) s_raster = new GFXcanvas1(display.width(), display.height());
+  return s_raster->getBuffer() ? s_raster : nullptr;
+}
+
+// Sizes the ring to RASTER_RING_PAGES, or as many as fit with
+// RASTER_RING_RESERVE to spare, in PSRAM when there is some.
+static void initRing() {
+  if (s_ringBuf || !rasterCanvas()) return;
+  size_t   n     = rasterBytes();
+  uint32_t caps  = psramFound() ? MALLOC_CAP_SPIRAM : MALLOC_CAP_8BIT;
+  size_t   avail = heap_caps_get_largest_free_block(caps);
+  size_t   spare = avail > RASTER_RING_RESERVE ? avail - RASTER_RING_RESERVE : 0;
+  s_ringSlots    = (int)min((size_t)RASTER_RING_PAGES, spare / n);
+  if (s_ringSlots > 0) s_ringBuf = (uint8_t*)heap_caps_malloc(s_ringSlots * n, caps);
+  if (!s_ringBuf) s_ringSlots = 0;
+  for (int i = 0; i < RASTER_RING_PAGES; i++) s_ringPage[i] = -1;
+  s_ringNext = 0;
+  ESP_LOGI(TAG, "page ring: %d slots", s_ringSlots);
+}
+
+// Global page number of a chunk's local page if it is drawn through a
+// raster, else -1. Needs the chunk's page count, so not before it is indexed.
+static int rasterPage(int chunk, int localPage) {
+  ChunkRec rec;
+  if (!s_raster || !s_raster->getBuffer()) return -1;
+  if (!chunkRec(chunk, rec) || rec.pageCount == 0) return -1;
+  return (int)rec.firstPage + localPage;
+}
+
+// Swaps a shadow raster holding `page` in as s_raster. E-ink task only.
+static bool takeShadow(int page) {
+  bool got = false;
+  xSemaphoreTake(s_shadowLock, portMAX_DELAY);
+  for (int k = 0; k < 2 && !got; k++) {
+    if (s_shadowPage[k] != page) continue;
+    std::swap(s_raster, s_shadow[k]);
+    s_shadowPage[k] = -1;
+    got             = true;
+  }
+  xSemaphoreGive(s_shadowLock);
+  return got;
+}
+
+// Brings global page `page` into s_raster: a shadow raster, the ring or the
+// SD cache, cheapest first.
+static bool loadRaster(int page) {
+  if (s_rasterPage == page) return true;
+  s_rasterPage = -1;
+  if (takeShadow(page)) {
+    ringPut(page, s_raster->getBuffer());
+  } else if (!ringGet(page, s_raster->getBuffer())) {
+    if (!readRaster(page, s_raster->getBuffer())) return false;
+    ringPut(page, s_raster->getBuffer());
+  }
+  s_rasterPage = page;
+  return true;
+}
+
+// Copies s_raster into the display buffer; its set bits are white.
+static void showRaster() {
+  display.drawBitmap(0, 0, s_raster->getBuffer(), s_raster->width(), s_raster->height(),
+                     GxEPD_WHITE, GxEPD_BLACK);
+}
+
+static bool rasterIdle() {
+  return battState == 5 || millis() - s_lastKeyMs >= RASTER_IDLE_MS;  // 5 = charging
+}
+
+// Lays out and draws global page `page` into canvas, or reads it from the SD
+// cache if it is there. Gives up once s_specGen moves past `gen`.
+static bool drawSpeculative(ChunkLayout& L, GFXcanvas1& canvas, int page, uint32_t gen) {
+  if (readRaster(page, canvas.getBuffer())) return true;
+  if (!layoutPage(L, page) || s_specGen != gen) return false;
+  canvas.fillScreen(GxEPD_WHITE);
+  renderPage(canvas, L, 0, L.chunk);
+  writeRaster(page, canvas.getBuffer());
+  return true;
+}
+
+// Draws `page` into the task's canvas and trades it for shadow k, unless the
+// reader has moved on. canvas then holds the shadow's old raster.
+static void speculate(ChunkLayout& L, GFXcanvas1*& canvas, int k, int page, uint32_t gen) {
+  if (page < 0 || !s_shadow[k]->getBuffer() || s_shadowPage[k] == page || ringHas(page)) return;
+  if (s_specGen != gen || s_pendingChunk >= 0) return;
+  if (!drawSpeculative(L, *canvas, page, gen)) return;
+  xSemaphoreTake(s_shadowLock, portMAX_DELAY);
+  if (s_specGen == gen) {
+    std::swap(canvas, s_shadow[k]);
+    s_shadowPage[k] = page;
+  }
+  xSemaphoreGive(s_shadowLock);
+}
+
+static void rasterTask(void* parameter) {
+  // Its own page view and raster, so it never waits on the e-ink task
+  PageViewPools* pools  = (PageViewPools*)allocLarge(sizeof(PageViewPools));
+  GFXcanvas1*    canvas = new GFXcanvas1(display.width(), display.height());
+  ChunkLayout    L;
+  if (pools) bindLayout(L, *pools);
+  for (int k = 0; k < 2; k++) s_shadow[k] = new GFXcanvas1(display.width(), display.height());
+
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(RASTER_IDLE_MS));
+    if (!pools || !canvas->getBuffer()) continue;
+    int      from = s_rasterFrom;
+    uint32_t gen  = s_specGen;
+
+    // The neighbours of the page on screen, straight away
+    speculate(L, canvas, 0, from, gen);
+    if (SPECULATE_PREV) speculate(L, canvas, 1, from - 2, gen);
+
+    // Then, when idle, pages further on into the SD cache
+    int last = (battState == 5) ? INT_MAX : from + RASTER_AHEAD;
+    for (int page = from; page >= 0 && page < last; page++) {
+      if (!s_rasterOn || !rasterIdle() || s_rasterFrom != from) break;  // reader is back
+      if (readRaster(page, nullptr)) continue;
+      if (!layoutPage(L, page)) break;  // end of the book, or not indexed yet
+      canvas->fillScreen(GxEPD_WHITE);
+      renderPage(*canvas, L, 0, L.chunk);
+      if (!writeRaster(page, canvas->getBuffer())) break;
+    }
+  }
+}
+
+static void readRasterMode() {
+  Preferences prefs;
+  prefs.begin("PocketMage", true);
+  s_rasterOn = prefs.getBool("BookRaster", false);
+  prefs.end();
+}
+
+static void saveRasterMode() {
+  Preferences prefs;
+  prefs.begin("PocketMage", false);
+  prefs.putBool("BookRaster", s_rasterOn);
+  prefs.end();
+}
+
+// Starts the raster task, and the SD cache for the open book if that mode is
+// on. Without memory for a raster, pages are drawn straight to the display.
+static void startRaster() {
+  if (!rasterCanvas()) return;
+  if (s_rasterOn) openRasterCache();
+  if (s_rasterHandle) return;
+  xTaskCreatePinnedToCore(rasterTask,            // Function name
+                          "bookRasterTask",      // Task name
+                          6144,                  // Stack size
+                          NULL,                  // Parameters
+                          tskIDLE_PRIORITY,      // Priority (below einkHandler)
+                          &s_rasterHandle,       // Task handle
+                          0);                    // Core ID (shared with einkHandler)
+}
+
+// Called after a page is shown: the task draws its neighbours and renders
+// ahead from the next one; whatever it was drawing for the last page is
+// dropped.
+static void kickRaster(int page) {
+  s_rasterFrom = (page >= 0) ? page + 1 : -1;
+  s_specGen    = s_specGen + 1;
+  if (s_rasterHandle) xTaskNotifyGive(s_rasterHandle);
+}
+
+// ── Chunk window ──────────────────────────────────────────────────────────────
+// Three slots hold the previous, current and next chunk. The prefetch task
+// (core 0, below the e-ink task's priority) fills whichever slot falls out of
+// the window after each transition, so stepping into a neighbour is a pointer
+// swap. s_windowLock guards slot ownership; the pools themselves are only
+// written by whoever moved the slot to SLOT_LOADING. For a resident book a
+// slot only holds a chunk until it is copied out to PSRAM.
+static TaskHandle_t s_prefetchHandle = NULL;
+
+static bool inWindow(int chunk, int centre) {
+  return chunk >= 0 && chunk >= centre - 1 && chunk <= centre + 1;
+}
+
+static ChunkLayout* findSlot(int chunk) {
+  if (ChunkLayout* R = residentLayout(chunk)) return R;
+  for (int i = 0; i < WINDOW_SLOTS; i++)
+    if (s_window[i].chunk == chunk && s_window[i].state != SLOT_EMPTY) return &s_window[i];
+  return nullptr;
+}
+
+// Picks a slot that may be overwritten: never the displayed or a loading one,
+// preferring slots outside the window around `centre`. Call with the lock held.
+static ChunkLayout* claimVictim(int centre) {
+  ChunkLayout* best = nullptr;
+  for (int i = 0; i < WINDOW_SLOTS; i++) {
+    ChunkLayout* L = &s_window[i];
+    if (L == s_cur || L->state == SLOT_LOADING) continue;
+    if (L->state == SLOT_EMPTY || !inWindow(L->chunk, centre)) return L;
+    if (!best) best = L;
+  }
+  return best;
+}
+
+// Loads `idx` into a free slot on the calling task. Returns the ready slot.
+static ChunkLayout* loadIntoWindow(int idx, int centre) {
+  xSemaphoreTake(s_windowLock, portMAX_DELAY);
+  ChunkLayout* L = findSlot(idx);
+  if (L) {
+    xSemaphoreGive(s_windowLock);
+    while (L->state == SLOT_LOADING) vTaskDelay(pdMS_TO_TICKS(5));  // prefetch finishing it
+    if (ChunkLayout* R = residentLayout(idx)) return R;  // and copying it out
+    if (L->state == SLOT_READY && L->chunk == idx) return L;
+    xSemaphoreTake(s_windowLock, portMAX_DELAY);
+  }
+  L = claimVictim(centre);
+  if (!L) {
+    xSemaphoreGive(s_windowLock);
+    return nullptr;
+  }
+  L->chunk = idx;
+  L->state = SLOT_LOADING;
+  xSemaphoreGive(s_windowLock);
+
+  bool         ok = loadChunk(*L, idx);
+  ChunkLayout* R  = ok ? keepResident(*L, idx) : nullptr;
+
+  xSemaphoreTake(s_windowLock, portMAX_DELAY);
+  L->state = (ok && !R) ? SLOT_READY : SLOT_EMPTY;
+  if (L->state == SLOT_EMPTY) L->chunk = -1;
+  xSemaphoreGive(s_windowLock);
+  return R ? R : ok ? L : nullptr;
+}
+
+static void prefetchTask(void* parameter) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    // Current chunk first if only its page view is showing, then the next
+    // chunk: forward reading is by far the common case.
+    int centre = currentChunk;
+    const int order[3] = {centre, centre + 1, centre - 1};
+    for (int k = 0; k < 3; k++) {
+      int idx = order[k];
+      if (!chunkReady(idx) || fileError) continue;
+      if (currentChunk != centre || s_pendingChunk >= 0) break;  // reader moved on
+      if (findSlot(idx)) continue;
+      loadIntoWindow(idx, centre);
+    }
+
+    // Then the rest of a resident book, until the reader moves or PSRAM runs out
+    for (int idx = 0; s_bookText && chunkReady(idx) && !fileError; idx++) {
+      if (currentChunk != centre || s_pendingChunk >= 0) break;
+      if (residentLayout(idx)) continue;
+      if (!loadIntoWindow(idx, centre) || !residentLayout(idx)) break;
+    }
+  }
+}
+
+static void kickPrefetch() {
+  if (s_prefetchHandle) xTaskNotifyGive(s_prefetchHandle);
+}
+
+static void startPrefetch() {
+  if (s_prefetchHandle) return;
+  xTaskCreatePinnedToCore(prefetchTask,          // Function name
+                          "bookPrefetchTask",    // Task name
+                          6144,                  // Stack size
+                          NULL,                  // Parameters
+                          tskIDLE_PRIORITY,      // Priority (below einkHandler)
+                          &s_prefetchHandle,     // Task handle
+                          0);                    // Core ID (shared with einkHandler)
+}
+
+// ── Bookmarks ─────────────────────────────────────────────────────────────────
+// <book>.bmark holds "@offset:skip": the byte offset of the source line the
+// page starts in and how many of its display lines came before, as in a
+// PageRec. Unlike a chunk and page number that survives an index rebuild.
+// The older "chunk:page" form is not trusted and opens the book at its start.
+// A loaded bookmark is placed by resolveView() once the index has scanned
+// past it (s_markPending above).
+static void loadBookmark() {
+  s_markPending = false;
+  s_markPreview = false;
+  if (!SD_MMC.exists(s_bmarkPath)) return;
+  File f = SD_MMC.open(s_bmarkPath, FILE_READ);
+  if (!f) return;
+  String data = f.readStringUntil('\n');
+  f.close();
+
+  int sep = data.indexOf(':');
+  if (!data.startsWith("@") || sep < 0) return;
+  s_markOffset  = (uint32_t)strtoul(data.substring(1, sep).c_str(), nullptr, 10);
+  s_markSkip    = (uint16_t)data.substring(sep + 1).toInt();
+  s_markPending = true;
 }
 
-// Returns 1-based global page and total, or -1/-1 if page counts are unknown.
-// Sums on the fly so currentChunk is always read at call time (after loadBookmark).
-static void getGlobalPageInfo(int& outPage, int& outTotal) {
-  if (s_totalPages <= 0 || s_numPageCounts == 0) { outPage = -1; outTotal = -1; return; }
-  int offset = 0;
-  for (int i = 0; i < currentChunk && i < s_numPageCounts; i++)
-    offset += s_pageCounts[i];
-  outPage  = offset + (int)pageIndex + 1;
-  outTotal = s_totalPages;
+// Display line `skip` of the source line at `offset` in the chunk laid out
+// in L, as a local page; the last line at or before offset if the book
+// changed under the bookmark.
+static int markPage(const ChunkLayout& L, uint32_t offset, uint16_t skip) {
+  ChunkSpan span;
+  int       startSkip = chunkSpan(L.chunk, span) ? span.startSkip : 0;
+  int       si        = 0;
+  while (si + 1 < L.sourceLinesUsed && L.srcOffset[si + 1] <= offset) si++;
+  if (L.sourceLinesUsed == 0) return 0;
+  int line = max((int)skip - (si == 0 ? startSkip : 0), 0);
+  line     = min(line, max((int)L.srcLineCount[si] - 1, 0));
+  return (L.srcLineStart[si] + line) / LINES_PER_PAGE;
 }
 
-// ── Layout ────────────────────────────────────────────────────────────────────
-
-static const char* internWord(const char* src, int len) {
-  int copyLen = (len > MAX_WORD_LEN) ? MAX_WORD_LEN : len;
-  if (s_textPoolUsed + copyLen + 1 > TEXT_POOL_CAP) return nullptr;
-  char* dst = s_textPool + s_textPoolUsed;
-  memcpy(dst, src, copyLen);
-  dst[copyLen] = '\0';
-  s_textPoolUsed += copyLen + 1;
-  return dst;
+// Where the current page starts, in bookmark terms: from the page table,
+// else from the chunk's layout while it is still being indexed.
+static void currentMark(uint32_t& offset, uint16_t& skip) {
+  PageRec   pr;
+  ChunkSpan span;
+  const ChunkLayout& L = *s_cur;
+  if (s_markPending) {
+    offset = s_markOffset;
+    skip   = s_markSkip;
+  } else if (readPageRec(chunkFirstPage(currentChunk) + (int)pageIndex, pr)) {
+    offset = pr.offset;
+    skip   = pr.skip;
+  } else if (s_cur != &s_pageView && L.chunk == currentChunk && L.sourceLinesUsed > 0 &&
+             chunkSpan(currentChunk, span)) {
+    int first = (int)(pageIndex * LINES_PER_PAGE);
+    int si    = 0;
+    while (si + 1 < L.sourceLinesUsed && L.srcLineStart[si + 1] <= first) si++;
+    offset = L.srcOffset[si];
+    skip   = (uint16_t)((si == 0 ? span.startSkip : 0) + max(first - L.srcLineStart[si], 0));
+  } else {
+    offset = chunkSpan(currentChunk, span) ? span.start : 0;
+    skip   = chunkSpan(currentChunk, span) ? span.startSkip : 0;
+  }
 }
 
-static void commitDisplayLine(int wordStart, int wordCount, SourceLine& src) {
-  if (s_displayLinesUsed >= DISPLAY_LINE_CAP) return;
-  DisplayLine& dl = s_displayLines[s_displayLinesUsed++];
-  dl.lineIdx   = s_lineIndex++;
-  dl.wordStart = (uint16_t)wordStart;
-  dl.wordCount = (uint8_t)(wordCount > 255 ? 255 : wordCount);
-  src.lineCount++;
+static void saveBookmark() {
+  if (fileError || indexError || memError) return;  // nothing was shown; keep the old mark
+  uint32_t offset;
+  uint16_t skip;
+  currentMark(offset, skip);
+  if (!SD_MMC.exists(BMARKS_DIR)) SD_MMC.mkdir(BMARKS_DIR);
+  File f = SD_MMC.open(s_bmarkPath, FILE_WRITE);
+  if (!f) return;
+  f.print("@" + String((unsigned long)offset) + ":" + String((unsigned)skip));
+  f.close();
 }
 
-static void layoutSegment(const char* seg, int segLen, bool bold, bool italic,
-                          char style, uint16_t textWidth,
-                          int& dlWordStart, int& dlWordCount, int& lineWidth,
-                          SourceLine& src) {
-  display.setFont(pickFont(style, bold, italic));
-  int16_t  x1, y1;
-  uint16_t sw, sh;
-  display.getTextBounds(SPACEWIDTH_SYMBOL, 0, 0, &x1, &y1, &sw, &sh);
+// ── Chunk transitions ─────────────────────────────────────────────────────────
+static void requestChunk(int idx, ulong page) {
+  if (!hasChunk(idx)) return;
+  s_pendingPage  = page;
+  s_pendingChunk = idx;
+  needsRedraw    = true;
+}
 
-  int wStart = 0;
-  while (wStart < segLen) {
-    int wEnd = wStart;
-    while (wEnd < segLen && seg[wEnd] != ' ') wEnd++;
-    int wLen = wEnd - wStart;
-    if (wLen > 0) {
-      const char* wordText = internWord(seg + wStart, wLen);
-      if (!wordText || s_wordRefsUsed >= WORD_REF_CAP) return;
-
-      uint16_t wpx, hpx;
-      display.getTextBounds(wordText, 0, 0, &x1, &y1, &wpx, &hpx);
-      int addWidth = (int)wpx + (int)sw + WORDWIDTH_BUFFER;
-
-      if (lineWidth > 0 && lineWidth + addWidth > (int)textWidth) {
-        commitDisplayLine(dlWordStart, dlWordCount, src);
-        dlWordStart = s_wordRefsUsed;
-        dlWordCount = 0;
-        lineWidth   = 0;
-      }
-      s_wordRefs[s_wordRefsUsed].text   = wordText;
-      s_wordRefs[s_wordRefsUsed].bold   = bold;
-      s_wordRefs[s_wordRefsUsed].italic = italic;
-      s_wordRefsUsed++;
-      dlWordCount++;
-      lineWidth += addWidth;
-    }
-    wStart = wEnd + 1;
+// Shows `page` of chunk idx, switching chunks only if needed.
+static void goToPage(int idx, ulong page) {
+  if (idx != currentChunk) {
+    requestChunk(idx, page);
+  } else {
+    pageIndex   = page;
+    needsRedraw = true;
   }
 }
 
-static void layoutSourceLine(const String& text, char style, ulong orderedListNum) {
-  if (s_sourceLinesUsed >= LINES_PER_CHUNK) return;
-
-  SourceLine& src    = s_sourceLines[s_sourceLinesUsed++];
-  src.style          = style;
-  src.orderedListNum = orderedListNum;
-  src.lineStart      = (uint16_t)s_displayLinesUsed;
-  src.lineCount      = 0;
+// Jumps to 0-based globalPage; false if it is not indexed yet.
+static bool goToGlobalPage(int globalPage) {
+  int     chunk, localPage;
+  PageRec pr;
+  if (readPageRec(globalPage, pr)) {
+    goToPage(pr.chunk, pr.localPage);
+  } else if (findPage(globalPage, chunk, localPage)) {
+    goToPage(chunk, (ulong)localPage);
+  } else {
+    return false;
+  }
+  return true;
+}
 
-  if (style == 'B' || style == 'H') {
-    commitDisplayLine(s_wordRefsUsed, 0, src);
-    return;
+// Jumps `percent` of the way into the book: by page once the total is known,
+// by byte offset while the index is still being built.
+static void goToPercent(int percent) {
+  percent = constrain(percent, 0, 100);
+  if (s_totalPages > 0) {
+    goToGlobalPage((int)((int64_t)(s_totalPages - 1) * percent / 100));
+  } else if (s_indexing) {
+    goToPage(chunkAtOffset((uint32_t)((uint64_t)s_ick.hdr.bookSize * percent / 100)), 0);
+  } else {
+    goToPage(currentChunk, (ulong)(getMaxPage() * percent / 100));
   }
+}
 
-  uint16_t textWidth = (uint16_t)(display.width() - DISPLAY_WIDTH_BUFFER);
-  if (style == '>' || style == 'C')
-    textWidth -= SPECIAL_PADDING;
-  else if (style == '-' || style == 'L')
-    textWidth -= 2 * SPECIAL_PADDING;
+// Byte offset of the top of the current page, as near as the index knows.
+static uint32_t currentOffset() {
+  PageRec   pr;
+  ChunkSpan span;
+  if (readPageRec(chunkFirstPage(currentChunk) + (int)pageIndex, pr)) return pr.offset;
+  return chunkSpan(currentChunk, span) ? span.start : 0;
+}
 
-  int dlWordStart = s_wordRefsUsed;
-  int dlWordCount = 0;
-  int lineWidth   = 0;
-
-  const char* raw = text.c_str();
-  int n = (int)text.length();
-  int i = 0;
-  while (i < n) {
-    bool bold = false, italic = false;
-    int segStart, segEnd;
-
-    if (raw[i] == '*' && i + 1 < n && raw[i + 1] == '*') {
-      bold     = true;
-      segStart = i + 2;
-      const char* e = strstr(raw + segStart, "**");
-      segEnd = e ? (int)(e - raw) : n;
-      i      = segEnd + 2;
-    } else if (raw[i] == '*') {
-      italic   = true;
-      segStart = i + 1;
-      const char* e = strchr(raw + segStart, '*');
-      segEnd = e ? (int)(e - raw) : n;
-      i      = segEnd + 1;
-    } else {
-      const char* nb = strstr(raw + i, "**");
-      const char* ni = strchr(raw + i, '*');
-      segStart = i;
-      segEnd   = n;
-      if (nb) segEnd = min(segEnd, (int)(nb - raw));
-      if (ni) segEnd = min(segEnd, (int)(ni - raw));
-      i = segEnd;
+// Chunks that can hold a match, ascending, from the word index: those with
+// every word and word start the query pins down (forEachQueryTerm()), the
+// rarest term's posting list intersected with the others'. Returns 0 if
+// such a term is not in the book, -1 if the index cannot narrow the search
+// (no index, no term in the query, or too many chunks).
+static int wordCandidates(uint32_t* cands, int cap) {
+  uint32_t hashes[Horspool::MAX_PATTERN / 2 + 1];
+  WixEntry entries[Horspool::MAX_PATTERN / 2 + 1];
+  int      nh = 0;
+  forEachQueryTerm(s_query, s_queryLen, [&](uint32_t h) { hashes[nh++] = h; });
+  if (!s_hasWordIndex || nh == 0) return -1;
+  File f = SD_MMC.open(s_wixPath, FILE_READ);
+  if (!f) return -1;
+
+  int rarest = 0;
+  for (int i = 0; i < nh; i++) {
+    if (!wixFind(f, hashes[i], entries[i])) {
+      f.close();
+      return 0;
     }
-
-    if (segEnd > segStart)
-      layoutSegment(raw + segStart, segEnd - segStart, bold, italic,
-                    style, textWidth, dlWordStart, dlWordCount, lineWidth, src);
+    if (entries[i].postCount < entries[rarest].postCount) rarest = i;
   }
 
-  if (dlWordCount > 0)
-    commitDisplayLine(dlWordStart, dlWordCount, src);
+  int n = -1;
+  if ((int)entries[rarest].postCount <= cap) {
+    PostingReader<File> r(f, entries[rarest]);
+    uint32_t            c;
+    n = 0;
+    while (n < cap && r.next(c)) cands[n++] = c;
+    for (int i = 0; i < nh && n > 0; i++) {
+      if (i == rarest) continue;
+      PostingReader<File> other(f, entries[i]);
+      int  kept = 0, j = 0;
+      bool have = other.next(c);
+      while (have && j < n) {
+        if (c < cands[j]) {
+          have = other.next(c);
+        } else {
+          if (c == cands[j]) cands[kept++] = c;
+          j++;
+        }
+      }
+      n = kept;
+    }
+  }
+  f.close();
+  return n;
 }
 
-// ── Index building ─────────────────────────────────────────────────────────────
-static void loadChunk(int idx, bool triggerRedraw);  // forward declaration
-
-static void buildIndex() {
-  u8g2.clearBuffer();
-  u8g2.setFont(u8g2_font_5x7_tf);
-  u8g2.drawStr(1, 9, "Indexing...");
-  u8g2.sendBuffer();
+// Scans just the byte ranges of chunks cands[0, n) (ascending), each run of
+// neighbours in one go. A chunk that ends inside a source line takes in the
+// next, so a match in the rest of that line is not missed.
+static int scanChunks(const Horspool& matcher, File& f, char* buf, const uint32_t* cands, int n) {
+  int total = 0;
+  for (int i = 0; i < n;) {
+    int       last = (int)cands[i++];
+    ChunkSpan span, next;
+    if (!chunkSpan(last, span)) break;
+    uint32_t start = span.start;
+    while ((i < n && (int)cands[i] == last + 1) || span.endSkip > 0) {
+      if (!chunkSpan(last + 1, next)) break;
+      last++;
+      if (i < n && (int)cands[i] == last) i++;
+      span.end     = next.end;
+      span.endSkip = next.endSkip;
+    }
+    int room = max(SEARCH_MAX_HITS - total, 0);
+    total += matcher.scan(f, start, span.end, buf, SEARCH_BUF_SIZE,
+                          s_hits + min(total, SEARCH_MAX_HITS), room);
+  }
+  return total;
+}
 
-  chunks.clear();
+// Finds s_query in the book and keeps the first SEARCH_MAX_HITS match
+// offsets. A query starting with a letter or digit only matches at the start
+// of a word, which lets the word index narrow even a one-word search. When
+// it can, only the chunks it names are read, which finds every match;
+// otherwise the whole book is streamed through Horspool. False if it could
+// not be run.
+static bool runSearch() {
+  Horspool matcher;
+  if (!matcher.setPattern(s_query, s_queryLen)) return false;
+  matcher.setWordStart(queryStartsWord(s_query, s_queryLen));
+  char* buf = (char*)allocLarge(SEARCH_BUF_SIZE + WIX_MAX_CANDIDATES * sizeof(uint32_t));
+  if (!buf) return false;
   File f = SD_MMC.open(s_bookPath, FILE_READ);
   if (!f) {
-    fileError = true;
-    return;
+    heap_caps_free(buf);
+    return false;
   }
 
-  char headBuf[64] = "";
-  int lineCount = 0;
-
-  ChunkInfo first;
-  first.offset  = 0;
-  first.heading = "";
-  chunks.push_back(first);
-
-  while (f.available()) {
-    char buf[256];
-    int len = 0;
-    while (f.available() && len < 255) {
-      char c = (char)f.read();
-      if (c == '\n') break;
-      buf[len++] = c;
-    }
-    buf[len] = '\0';
-    if (len > 0 && buf[len - 1] == '\r') buf[--len] = '\0';
-
-    if (buf[0] == '#' && buf[1] == ' ') {
-      size_t hlen = strlen(buf + 2);
-      if (hlen >= sizeof(headBuf)) hlen = sizeof(headBuf) - 1;
-      memcpy(headBuf, buf + 2, hlen);
-      headBuf[hlen] = '\0';
-      if (chunks.back().heading.length() == 0)
-        chunks.back().heading = String(headBuf);
-    }
-
-    lineCount++;
-    if (lineCount % LINES_PER_CHUNK == 0) {
-      ChunkInfo ci;
-      ci.offset  = (size_t)f.position();
-      ci.heading = String(headBuf);
-      chunks.push_back(ci);
-    }
-  }
+  unsigned long t0    = millis();
+  uint32_t*     cands = (uint32_t*)(buf + SEARCH_BUF_SIZE);
+  int           nc    = wordCandidates(cands, WIX_MAX_CANDIDATES);
+  if (nc >= 0)
+    s_hitTotal = scanChunks(matcher, f, buf, cands, nc);
+  else
+    s_hitTotal = matcher.scan(f, 0, UINT32_MAX, buf, SEARCH_BUF_SIZE, s_hits, SEARCH_MAX_HITS);
+  s_hitCount = min(s_hitTotal, SEARCH_MAX_HITS);
+  s_hitSel   = -1;
+  ESP_LOGI(TAG, "Search \"%s\": %d hits, %d indexed chunks, %lu ms", s_query, s_hitTotal, nc,
+           millis() - t0);
   f.close();
+  heap_caps_free(buf);
+  return true;
+}
 
-  // Count pages per chunk into a short-lived stack array (512 bytes, BSS-free)
-  u8g2.clearBuffer();
-  u8g2.setFont(u8g2_font_5x7_tf);
-  u8g2.drawStr(1, 9, "Counting pages...");
-  u8g2.sendBuffer();
-  int nChunks = (int)chunks.size();
-  if (nChunks > MAX_CHUNKS) nChunks = MAX_CHUNKS;
-  int pageCounts[MAX_CHUNKS] = {};
-  for (int i = 0; i < nChunks; i++) {
-    loadChunk(i, false);
-    pageCounts[i] = getMaxPage() + 1;
-  }
-  needsRedraw = false;
+// Global page showing byte `at`. The page table only knows which source
+// line a page starts in, so when the last page starting at or before `at`
+// starts inside its paragraph, the pages back to the paragraph's start are
+// laid out one at a time to see where their text begins. -1 without a page
+// table.
+static int hitPage(uint32_t at) {
+  int chunk, localPage;
+  pageAtOffset(at, chunk, localPage);
+  int     page = chunkFirstPage(chunk) + localPage;
+  PageRec pr;
+  if (!readPageRec(page, pr)) return -1;
+  if (pr.skip == 0) return page;
+
+  PageViewPools* pools = (PageViewPools*)allocLarge(sizeof(PageViewPools));
+  if (!pools) return page;
+  ChunkLayout L;
+  bindLayout(L, *pools);
+  uint32_t line = pr.offset;
+  page = pageShowing(
+      at, page, [&](int p) { return readPageRec(p, pr) && pr.offset == line && pr.skip > 0; },
+      [&](int p) { return layoutPage(L, p) && L.wordRefsUsed > 0 ? line + L.wordOff[0] : 0; });
+  heap_caps_free(pools);
+  return page;
+}
 
-  // Populate s_pageCounts and persist to .idx
-  s_numPageCounts = nChunks;
-  s_totalPages    = 0;
-  for (int i = 0; i < nChunks; i++) {
-    s_pageCounts[i] = pageCounts[i];
-    s_totalPages   += pageCounts[i];
-  }
-  if (!SD_MMC.exists(BMARKS_DIR)) SD_MMC.mkdir(BMARKS_DIR);
-  File idx = SD_MMC.open(s_idxPath, FILE_WRITE);
-  if (idx) {
-    for (int i = 0; i < nChunks; i++) {
-      idx.print(String((unsigned long)chunks[i].offset));
-      idx.print('\t');
-      idx.print(chunks[i].heading);
-      idx.print('\t');
-      idx.print(pageCounts[i]);
-      idx.print('\n');
-    }
-    idx.close();
-  }
+static void goToHit(int i) {
+  if (i < 0 || i >= s_hitCount) return;
+  s_hitSel = i;
+  int page = hitPage(s_hits[i]);
+  if (page >= 0 && goToGlobalPage(page)) return;
+  int chunk, localPage;
+  pageAtOffset(s_hits[i], chunk, localPage);
+  goToPage(chunk, (ulong)localPage);
 }
 
-static bool loadIndex() {
-  if (!SD_MMC.exists(s_idxPath)) return false;
-  File f = SD_MMC.open(s_idxPath, FILE_READ);
-  if (!f) return false;
+// First hit at or after the top of the current page, wrapping to the start.
+static int firstHitFromHere() {
+  uint32_t from = currentOffset();
+  int      i    = (int)(std::lower_bound(s_hits, s_hits + s_hitCount, from) - s_hits);
+  return i < s_hitCount ? i : 0;
+}
 
-  chunks.clear();
-  s_numPageCounts   = 0;
-  s_totalPages      = 0;
-  bool allHavePageCount = true;
-  while (f.available()) {
-    String line = f.readStringUntil('\n');
-    line.trim();
-    if (line.length() == 0) continue;
-    int tab = line.indexOf('\t');
-    ChunkInfo ci;
-    int pageCount = 0;
-    if (tab >= 0) {
-      ci.offset   = (size_t)line.substring(0, tab).toInt();
-      int tab2    = line.indexOf('\t', tab + 1);
-      if (tab2 >= 0) {
-        ci.heading = line.substring(tab + 1, tab2);
-        pageCount  = line.substring(tab2 + 1).toInt();
-      } else {
-        ci.heading = line.substring(tab + 1);
-      }
-    } else {
-      ci.offset  = (size_t)line.toInt();
-      ci.heading = "";
-    }
-    if (pageCount <= 0) allHavePageCount = false;
-    if (s_numPageCounts < MAX_CHUNKS) s_pageCounts[s_numPageCounts] = pageCount;
-    s_numPageCounts++;
-    s_totalPages += pageCount;
-    chunks.push_back(ci);
+static bool readTocRec(int i, TocRec& t) {
+  if (i < 0 || i >= s_tocCount) return false;
+  File f  = SD_MMC.open(s_tocPath, FILE_READ);
+  bool ok = f && f.seek((uint32_t)i * sizeof(TocRec)) &&
+            f.read((uint8_t*)&t, sizeof(t)) == sizeof(t);
+  if (f) f.close();
+  return ok;
+}
+
+// Number of TOC entries starting on or before global page `page`, by binary
+// search in the .toc.
+static int tocEntriesUpTo(int page) {
+  File f = SD_MMC.open(s_tocPath, FILE_READ);
+  if (!f) return 0;
+  int lo = 0, hi = s_tocCount;  // first entry starting after page
+  while (lo < hi) {
+    int    mid = lo + (hi - lo) / 2;
+    TocRec t;
+    if (!f.seek((uint32_t)mid * sizeof(TocRec)) ||
+        f.read((uint8_t*)&t, sizeof(t)) != sizeof(t))
+      break;
+    if ((int)t.page > page) hi = mid;
+    else lo = mid + 1;
   }
   f.close();
-  // If any chunk is missing page counts, force a rebuild
-  if (!allHavePageCount) {
-    chunks.clear();
-    s_numPageCounts = 0;
-    s_totalPages    = 0;
-    return false;
-  }
-  return !chunks.empty();
+  return lo;
 }
 
-static void buildOrLoadIndex() {
-  if (!loadIndex()) buildIndex();
-  if (chunks.empty()) {
-    ChunkInfo fallback;
-    fallback.offset  = 0;
-    fallback.heading = "";
-    chunks.push_back(fallback);
+// Heading jumps go by the .toc, which has every heading's own page. Until
+// indexing finishes there is none, and they go by the "# " heading each
+// chunk is listed under.
+static void goToNextHeading() {
+  TocRec t;
+  if (s_tocCount > 0) {
+    int here = chunkFirstPage(currentChunk) + (int)pageIndex;
+    if (readTocRec(tocEntriesUpTo(here), t)) goToGlobalPage((int)t.page);
+    return;
   }
+  int c = nextHeading(currentChunk);
+  if (c >= 0) goToPage(c, 0);
 }
 
-// ── Chunk loading ──────────────────────────────────────────────────────────────
-static void loadChunk(int idx, bool triggerRedraw) {
-  if (idx < 0 || idx >= (int)chunks.size()) return;
-
-  File f = SD_MMC.open(s_bookPath, FILE_READ);
-  if (!f) {
-    fileError = true;
+// Back to the start of the current heading, or to the previous one when
+// already there.
+static void goToPrevHeading() {
+  TocRec t;
+  if (s_tocCount > 0) {
+    int here = chunkFirstPage(currentChunk) + (int)pageIndex;
+    int i    = tocEntriesUpTo(here) - 1;
+    if (readTocRec(i, t) && (int)t.page == here) i--;
+    goToGlobalPage(readTocRec(i, t) ? (int)t.page : 0);
     return;
   }
+  int start = headingStart(currentChunk);
+  if (start == currentChunk && pageIndex == 0 && start > 0) start = headingStart(start - 1);
+  goToPage(start, 0);
+}
 
-  f.seek(chunks[idx].offset);
-  size_t endOffset = (idx + 1 < (int)chunks.size()) ? chunks[idx + 1].offset : 0;
-
-  s_textPoolUsed     = 0;
-  s_wordRefsUsed     = 0;
-  s_displayLinesUsed = 0;
-  s_sourceLinesUsed  = 0;
-  s_lineIndex        = 0;
-
-  ulong listCounter = 1;
-  int   lineCount   = 0;
-
-  while (f.available()) {
-    if (endOffset != 0 && (size_t)f.position() >= endOffset) break;
-    if (lineCount >= LINES_PER_CHUNK) break;
-
-    String raw = f.readStringUntil('\n');
-    raw.trim();
-
-    char   st = 'T';
-    String content;
-
-    if (raw.length() == 0) {
-      st = 'B';
-    } else if (raw == "---") {
-      st = 'H';
-    } else if (raw.startsWith("# ")) {
-      st = '1'; content = raw.substring(2);
-      if (chunks[idx].heading.length() == 0) chunks[idx].heading = content;
-    } else if (raw.startsWith("## ")) {
-      st = '2'; content = raw.substring(3);
-    } else if (raw.startsWith("### ")) {
-      st = '3'; content = raw.substring(4);
-    } else if (raw.startsWith("> ")) {
-      st = '>'; content = raw.substring(2);
-    } else if (raw.startsWith("- ")) {
-      st = '-'; content = raw.substring(2); listCounter = 1;
-    } else if (raw.startsWith("```")) {
-      st = 'C';
-    } else if (raw.length() >= 3 && isDigit(raw[0]) && raw[1] == '.' && raw[2] == ' ') {
-      st = 'L'; content = raw.substring(3);
-    } else {
-      content = std::move(raw);
-    }
-
-    ulong listNum = (st == 'L') ? listCounter++ : 0;
-    if (st != 'L') listCounter = 1;
+// TOC entry the reader is under: the last heading starting on or before the
+// current page.
+static int tocEntryHere() {
+  return max(tocEntriesUpTo(chunkFirstPage(currentChunk) + (int)pageIndex) - 1, 0);
+}
 
-    layoutSourceLine(content, st, listNum);
-    lineCount++;
-  }
-  f.close();
+static void openToc() {
+  s_tocSel    = tocEntryHere();
+  s_tocScroll = constrain(s_tocSel - TOC_VISIBLE / 2, 0, max(s_tocCount - TOC_VISIBLE, 0));
+  appMode     = MODE_TOC;
+  needsRedraw = true;
+}
 
-  if (s_sourceLinesUsed == 0)
-    layoutSourceLine(String("(empty)"), 'T', 0);
+static void moveTocSel(int delta) {
+  s_tocSel = constrain(s_tocSel + delta, 0, s_tocCount - 1);
+  if (s_tocSel < s_tocScroll) s_tocScroll = s_tocSel;
+  if (s_tocSel >= s_tocScroll + TOC_VISIBLE) s_tocScroll = s_tocSel - TOC_VISIBLE + 1;
+  needsRedraw = true;
+}
 
-  if (triggerRedraw) needsRedraw = true;
+static void goToTocEntry(int i) {
+  TocRec t;
+  bool   ok = readTocRec(i, t);
+  appMode   = MODE_READING;
+  if (!ok || !goToGlobalPage((int)t.page)) needsRedraw = true;
 }
 
-// ── Bookmarks ─────────────────────────────────────────────────────────────────
-static void loadBookmark() {
-  if (!SD_MMC.exists(s_bmarkPath)) return;
-  File f = SD_MMC.open(s_bmarkPath, FILE_READ);
-  if (!f) return;
-  String data = f.readStringUntil('\n');
+// Lays the bookmarked page out into the page view straight from the mark,
+// which needs the book's text but no chunk record, so a book opens at its
+// bookmark while the index is still scanning towards it. Shown without a
+// page number; resolveView() places the mark in its chunk once that is
+// indexed, and navigation waits until then.
+static bool previewMark() {
+  File f;
+  if (!openBookText(f)) return false;
+  s_pageViewPage = -1;
+  resetLayout(s_pageView);
+  layoutLines(s_pageView, f, s_markOffset, BOOK_END, 0, 1, s_markSkip, PAGE_VIEW_LINES);
   f.close();
+  if (s_pageView.displayLinesUsed == 0) return false;
+  s_pageView.chunk = -1;
+  s_cur            = &s_pageView;
+  s_pageStartLine  = 0;
+  s_viewPage       = -1;
+  s_markPreview    = true;
+  return true;
+}
 
-  int sep = data.indexOf(':');
-  if (sep < 0) return;
+// Runs on the e-ink task before every reading-mode render. Applies a pending
+// chunk switch and points s_cur at a layout holding (currentChunk, pageIndex):
+// a resident chunk is used as-is, otherwise just that page is laid out from
+// the page table and the prefetch task brings in the rest of the chunk.
+// s_pendingChunk stays set until this is done so processKB_APP() ignores
+// navigation in the meantime. Returns false, leaving the switch pending, while
+// the index task has not yet scanned to the end of the requested chunk;
+// for a bookmark, previewMark() shows its page meanwhile.
+static bool resolveView() {
+  int  idx      = s_pendingChunk;
+  bool switched = idx >= 0;
+  if (switched && s_markPending) idx = chunkAtOffset(s_markOffset, s_markSkip);
+  if (switched && !chunkReady(idx)) return s_markPending && previewMark();
+  s_markPreview = false;
+  if (switched) {
+    currentChunk = idx;
+    pageIndex    = s_pendingPage;
+  }
+  if (s_markPending && s_hasPageTable) {
+    int chunk, localPage;
+    pageAtOffset(s_markOffset, chunk, localPage, s_markSkip);
+    pageIndex     = (ulong)localPage;
+    s_markPending = false;
+  }
 
-  int   ck = data.substring(0, sep).toInt();
-  ulong pg = (ulong)data.substring(sep + 1).toInt();
+  ChunkLayout* L = findSlot(currentChunk);
+  if (L && L->state != SLOT_READY) L = nullptr;
+
+  s_viewPage = -1;
+  if (!L && s_hasPageTable) {
+    int mp = chunkMaxPage(currentChunk);
+    if ((int)pageIndex > mp) pageIndex = (ulong)mp;
+    int page   = chunkFirstPage(currentChunk) + (int)pageIndex;
+    int cached = rasterPage(currentChunk, (int)pageIndex);
+    if (cached >= 0 && loadRaster(cached)) {
+      s_viewPage = cached;  // shown as-is; s_cur is not drawn from
+    } else if (layoutPageView(page)) {
+      s_cur           = &s_pageView;
+      s_pageStartLine = 0;
+      s_viewPage      = cached;
+    } else {
+      L = loadIntoWindow(currentChunk, currentChunk);
+    }
+  } else if (!L) {
+    L = loadIntoWindow(currentChunk, currentChunk);
+  }
 
-  if (ck >= 0 && ck < (int)chunks.size()) {
-    currentChunk = ck;
-    pageIndex    = pg;
+  if (L) {
+    s_cur = L;
+    if (s_markPending) {  // no page table yet: find the bookmark in the layout
+      pageIndex     = (ulong)markPage(*L, s_markOffset, s_markSkip);
+      s_markPending = false;
+    }
+    int mp = getMaxPage();
+    if ((int)pageIndex > mp) pageIndex = (ulong)mp;
+    s_pageStartLine = pageIndex * LINES_PER_PAGE;
+    s_viewPage      = rasterPage(currentChunk, (int)(s_pageStartLine / LINES_PER_PAGE));
   }
-}
 
-static void saveBookmark() {
-  if (!SD_MMC.exists(BMARKS_DIR)) SD_MMC.mkdir(BMARKS_DIR);
-  File f = SD_MMC.open(s_bmarkPath, FILE_WRITE);
-  if (!f) return;
-  f.print(String(currentChunk) + ":" + String((unsigned long)pageIndex));
-  f.close();
+  if (switched) {
+    saveBookmark();
+    s_pendingChunk = -1;
+  }
+  kickPrefetch();
+  return true;
 }
 
 // ── Book scanning ─────────────────────────────────────────────────────────────
@@ -625,11 +3097,30 @@ static void updateOLED() {
   } else if (appMode == MODE_PAGE_JUMP) {
     char prompt[32];
     int maxPg = (s_totalPages > 0) ? s_totalPages : (getMaxPage() + 1);
-    snprintf(prompt, sizeof(prompt), "Go to page (1-%d):", maxPg);
+    snprintf(prompt, sizeof(prompt), "Go to page (1-%d) or %%:", maxPg);
     u8g2.drawStr(1, 9, prompt);
     u8g2.drawStr(1, 20, s_jumpBuf);
+  } else if (appMode == MODE_TOC) {
+    u8g2.drawStr(1, 9, "Contents");
+    char hint[48];
+    snprintf(hint, sizeof(hint), "Heading %d/%d   SPC go  ESC back", s_tocSel + 1, s_tocCount);
+    u8g2.drawStr(1, 20, hint);
+  } else if (appMode == MODE_SEARCH) {
+    u8g2.drawStr(1, 9,
+                 s_searchMiss ? "No matches. Find word start:" : "Find word start (ENTER, ESC):");
+    String q = String(s_query) + "_";
+    u8g2.drawStr(1, 20, q.c_str());
+  } else if (memError) {
+    u8g2.drawStr(1, 9, "Not enough memory to read");
+    u8g2.drawStr(1, 20, "ESC back");
+  } else if (indexError) {
+    u8g2.drawStr(1, 9, "Cannot write book index");
+    u8g2.drawStr(1, 20, "SD card full or read-only?  ESC back");
+  } else if (s_markPreview) {
+    u8g2.drawStr(1, 9, s_bookDisplayName);
+    u8g2.drawStr(1, 20, "Pg ?/?   indexing up to the bookmark...");
   } else {
-    if (chunks.empty() || currentChunk >= (int)chunks.size()) {
+    if (currentChunk >= chunkCount()) {
       u8g2.sendBuffer();
       return;
     }
@@ -640,7 +3131,7 @@ static void updateOLED() {
     if (globalPage > 0 && totalPages > 0) {
       progress = (float)(globalPage - 1) / (float)totalPages;
     } else {
-      int totalCk = (int)chunks.size();
+      int totalCk = chunkCount();
       int maxPg   = getMaxPage();
       progress = (totalCk <= 1)
           ? (maxPg > 0 ? (float)pageIndex / (float)maxPg : 1.0f)
@@ -650,17 +3141,24 @@ static void updateOLED() {
     progress = constrain(progress, 0.0f, 1.0f);
     int barFill = (int)(253.0f * progress);
 
-    String title = chunks[currentChunk].heading;
+    String title = chunkHeading(currentChunk);
     if (title.length() == 0) title = String(s_bookDisplayName);
     if ((int)title.length() > 36) title = title.substring(0, 35) + "~";
     u8g2.drawStr(1, 9, title.c_str());
 
     String info;
-    if (globalPage > 0 && totalPages > 0) {
-      info = "Pg " + String(globalPage) + "/" + String(totalPages);
+    if (globalPage > 0) {
+      info = "Pg " + String(globalPage) + "/" + (totalPages > 0 ? String(totalPages) : "?");
+    } else if (s_indexing) {
+      info = "Pg " + String((unsigned long)(pageIndex + 1)) + "/?";
     } else {
       info = "Pg " + String((unsigned long)(pageIndex + 1)) + "/" + String(getMaxPage() + 1);
     }
+    if (s_hitSel >= 0) {
+      info += "   Hit " + String(s_hitSel + 1) + "/" + String(s_hitCount);
+      if (s_hitTotal > s_hitCount) info += "+";
+      info += "  n/N";
+    }
     u8g2.drawStr(1, 20, info.c_str());
 
     u8g2.drawFrame(0, 25, 256, 7);
@@ -670,111 +3168,87 @@ static void updateOLED() {
   u8g2.sendBuffer();
 }
 
-// ── Document rendering ────────────────────────────────────────────────────────
-static int renderSourceLine(int si, int startX, int startY) {
-  const SourceLine& src   = s_sourceLines[si];
-  char              style = src.style;
-
-  if (src.lineCount > 0 &&
-      s_displayLines[src.lineStart + src.lineCount - 1].lineIdx < s_pageStartLine)
-    return 0;
-
-  if (style == 'H') {
-    display.drawFastHLine(0, startY + 3, display.width(), GxEPD_BLACK);
-    display.drawFastHLine(0, startY + 4, display.width(), GxEPD_BLACK);
-    return 8;
+// ── TOC rendering ─────────────────────────────────────────────────────────────
+static char s_tocText[TOC_VISIBLE][64];
+
+// The visible entries, indented by level with their page numbers right-aligned.
+static void renderToc() {
+  TocRec recs[TOC_VISIBLE];
+  int    n   = 0;
+  File   toc = SD_MMC.open(s_tocPath, FILE_READ);
+  if (toc && toc.seek((uint32_t)s_tocScroll * sizeof(TocRec)))
+    n = (int)(toc.read((uint8_t*)recs, sizeof(recs)) / sizeof(TocRec));
+  if (toc) toc.close();
+  n = min(n, s_tocCount - s_tocScroll);
+
+  xSemaphoreTake(s_indexLock, portMAX_DELAY);
+  File hdg = SD_MMC.open(s_hdgPath, FILE_READ);
+  for (int i = 0; i < n; i++) {
+    size_t got = 0;
+    if (hdg && hdg.seek(recs[i].textOff)) got = hdg.read((uint8_t*)s_tocText[i], 63);
+    s_tocText[i][got] = '\0';
   }
-  if (style == 'B') return 12;
-
-  int drawX = startX;
-  if (style == '>')
-    drawX += SPECIAL_PADDING;
-  else if (style == '-' || style == 'L')
-    drawX += 2 * SPECIAL_PADDING;
-  else if (style == 'C')
-    drawX += SPECIAL_PADDING / 2;
-
-  int cursorY = startY;
+  if (hdg) hdg.close();
+  xSemaphoreGive(s_indexLock);
 
-  for (int li = src.lineStart; li < src.lineStart + src.lineCount; li++) {
-    const DisplayLine& dl = s_displayLines[li];
-    if (dl.lineIdx < s_pageStartLine) continue;
-
-    int      cx      = drawX;
-    uint16_t max_hpx = 0;
+  display.setFont(&Font5x7Fixed);
+  display.setCursor(4, 11);
+  display.print("Contents");
+  display.drawFastHLine(0, 14, display.width(), GxEPD_BLACK);
 
-    for (int wi = dl.wordStart; wi < dl.wordStart + dl.wordCount; wi++) {
-      const WordRef& w = s_wordRefs[wi];
-      display.setFont(pickFont(style, w.bold, w.italic));
-      int16_t  x1, y1;
-      uint16_t wpx, hpx;
-      display.getTextBounds(w.text, cx, cursorY, &x1, &y1, &wpx, &hpx);
-      if (hpx > max_hpx) max_hpx = hpx;
-    }
-    if (style == '1' || style == '2' || style == '3') max_hpx += 4;
-
-    for (int wi = dl.wordStart; wi < dl.wordStart + dl.wordCount; wi++) {
-      const WordRef& w = s_wordRefs[wi];
-      display.setFont(pickFont(style, w.bold, w.italic));
-      int16_t  x1, y1;
-      uint16_t wpx, hpx, sw, sh;
-      display.getTextBounds(w.text, cx, cursorY, &x1, &y1, &wpx, &hpx);
-      display.getTextBounds(SPACEWIDTH_SYMBOL, cx, cursorY, &x1, &y1, &sw, &sh);
-      display.setCursor(cx, cursorY + max_hpx);
-      display.print(w.text);
-      cx += (int)wpx + (int)sw;
+  int lineH = 20;
+  int y     = 14 + lineH;  // first item baseline
+  for (int i = 0; i < n; i++) {
+    const TocRec& t = recs[i];
+    if (s_tocScroll + i == s_tocSel) {
+      display.fillRect(0, y - lineH + 2, display.width(), lineH, GxEPD_BLACK);
+      display.setTextColor(GxEPD_WHITE);
+    } else {
+      display.setTextColor(GxEPD_BLACK);
     }
+    FontMetrics fm(t.level == 1 ? &FreeSerifBold9pt7b : &FreeSerif9pt7b);
+    display.setFont(fm.font());
 
-    uint8_t pad = (style == '1' || style == '2' || style == '3') ? HEADING_LINE_PADDING
-                                                                  : NORMAL_LINE_PADDING;
-    cursorY += (int)max_hpx + (int)pad;
-  }
-
-  if (style == '>') {
-    display.drawFastVLine(SPECIAL_PADDING / 2, startY, cursorY - startY, GxEPD_BLACK);
-    display.drawFastVLine(SPECIAL_PADDING / 2 + 1, startY, cursorY - startY, GxEPD_BLACK);
-  } else if (style == 'C') {
-    display.drawFastVLine(SPECIAL_PADDING / 4, startY, cursorY - startY, GxEPD_BLACK);
-    display.drawFastVLine(SPECIAL_PADDING / 4 + 1, startY, cursorY - startY, GxEPD_BLACK);
-    display.drawFastVLine(display.width() - SPECIAL_PADDING / 4, startY, cursorY - startY,
-                          GxEPD_BLACK);
-    display.drawFastVLine(display.width() - SPECIAL_PADDING / 4 - 1, startY, cursorY - startY,
-                          GxEPD_BLACK);
-  } else if (style == '1' || style == '2' || style == '3') {
-    display.drawFastHLine(0, cursorY - 2, display.width(), GxEPD_BLACK);
-    display.drawFastHLine(0, cursorY - 3, display.width(), GxEPD_BLACK);
-  } else if (style == '-') {
-    display.fillCircle(drawX - 8, startY + 8, 3, GxEPD_BLACK);
-  } else if (style == 'L') {
-    char num[16];
-    snprintf(num, sizeof(num), "%lu. ", src.orderedListNum);
-    display.setFont(pickFont('T', false, false));
-    int16_t  x1, y1;
-    uint16_t wpx, hpx;
-    display.getTextBounds(num, 0, 0, &x1, &y1, &wpx, &hpx);
-    display.setCursor(drawX - (int)wpx - 5, startY + (int)hpx);
+    char num[12];
+    snprintf(num, sizeof(num), "%u", (unsigned)(t.page + 1));
+    int numX = display.width() - 6 - fm.advance(num);
+    display.setCursor(numX, y);
     display.print(num);
-  }
-
-  return cursorY - startY;
-}
 
-static void renderDocument(int startX, int startY) {
-  s_pageStartLine = pageIndex * LINES_PER_PAGE;
-  int cursorY = startY;
-  for (int si = 0; si < s_sourceLinesUsed; si++) {
-    if (cursorY >= display.height() - 6) break;
-    cursorY += renderSourceLine(si, startX, cursorY);
+    // Drop characters until the title clears the page number
+    int   x    = 6 + (constrain(t.level, 1, 3) - 1) * 12;
+    char* text = s_tocText[i];
+    int   len  = (int)strlen(text);
+    int   w    = fm.advance(text, len);
+    while (len > 0 && x + w > numX - 8) {
+      w -= fm.advance(text + len - 1, 1);
+      text[--len] = '\0';
+    }
+    display.setCursor(x, y);
+    display.print(text);
+    y += lineH;
   }
+  display.setTextColor(GxEPD_BLACK);
+
+  display.setFont(&Font5x7Fixed);
+  display.setCursor(2, display.height() - 2);
+  display.print("< > select   FN+< > page   SPC go   ESC back");
 }
 
 // ── Entry points ──────────────────────────────────────────────────────────────
 void APP_INIT() {
   initFonts();
+  memError = !initWindow();
+  if (!s_windowLock) s_windowLock = xSemaphoreCreateMutex();
+  if (!s_indexLock)  s_indexLock  = xSemaphoreCreateMutex();
+  if (!s_rasterLock) s_rasterLock = xSemaphoreCreateMutex();
+  if (!s_shadowLock) s_shadowLock = xSemaphoreCreateMutex();
+  s_pageWidth  = display.width();
   fileError    = false;
+  indexError   = false;
   currentChunk = 0;
   pageIndex    = 0;
-  needsRedraw  = true;
+  needsRedraw  = false;  // set once there is something to draw
 
   // Check if a book was previously selected
   char fname[MAX_BOOK_NAME] = "";
@@ -784,13 +3258,17 @@ void APP_INIT() {
     if (SD_MMC.exists(checkPath)) {
       setPaths(fname);
       appMode = MODE_READING;
-      buildOrLoadIndex();
-      if (!fileError) {
+      initRing();
+      loadResidentBook();
+      if (memError) ESP_LOGE(TAG, "No memory for the layout window");
+      if (!memError && buildOrLoadIndex()) {
         loadBookmark();
-        loadChunk(currentChunk, true);
-        int mp = getMaxPage();
-        if ((int)pageIndex > mp) pageIndex = (ulong)mp;
+        startPrefetch();
+        readRasterMode();
+        startRaster();
+        requestChunk(currentChunk, pageIndex);  // e-ink task loads and clamps the page
       }
+      needsRedraw = true;
       return;
     }
     // File no longer exists — fall through to picker
@@ -802,6 +3280,7 @@ void APP_INIT() {
   scanBooks();
   s_pickerSel    = 0;
   s_pickerScroll = 0;
+  needsRedraw    = true;
 
   // Auto-select if only one book
   if (s_bookCount == 1) {
@@ -814,7 +3293,7 @@ void APP_INIT() {
 
 void processKB_APP() {
   // ── Touch scroll (reading mode only) ──────────────────────────────────────
-  if (appMode == MODE_READING) {
+  if (appMode == MODE_READING && s_pendingChunk < 0) {
     TOUCH().updateScrollRaw();
     long int cur   = TOUCH().getDynamicScroll();
     long int delta = cur - s_scrollBase;
@@ -823,14 +3302,11 @@ void processKB_APP() {
       if (delta >= SWIPE_THRESHOLD) {
         s_scrollBase          = cur;
         s_scrollCooldownUntil = millis() + SWIPE_COOLDOWN_MS;
-        if ((int)pageIndex < getMaxPage()) {
+        if ((int)pageIndex < chunkMaxPage(currentChunk)) {
           pageIndex++;
           needsRedraw = true;
-        } else if (currentChunk + 1 < (int)chunks.size()) {
-          currentChunk++;
-          pageIndex = 0;
-          saveBookmark();
-          seamlessRestart();
+        } else if (hasChunk(currentChunk + 1)) {
+          requestChunk(currentChunk + 1, 0);
         }
       } else if (delta <= -SWIPE_THRESHOLD) {
         s_scrollBase          = cur;
@@ -839,10 +3315,7 @@ void processKB_APP() {
           pageIndex--;
           needsRedraw = true;
         } else if (currentChunk > 0) {
-          currentChunk--;
-          pageIndex = 65535;
-          saveBookmark();
-          seamlessRestart();
+          requestChunk(currentChunk - 1, LAST_PAGE);
         }
       }
     } else {
@@ -852,6 +3325,7 @@ void processKB_APP() {
 
   char ch = KB().updateKeypress();
   if (!ch) return;
+  s_lastKeyMs = millis();
 
   if (appMode == MODE_PICKER) {
     if (ch == 27 || ch == 65) {  // ESC or A — exit to OS
@@ -893,34 +3367,16 @@ void processKB_APP() {
         s_jumpBuf[s_jumpLen]   = '\0';
         updateOLED();
       }
-    } else if (ch == 13 || ch == 32) {  // Enter or Space — commit
-      if (s_jumpLen > 0) {
+    } else if (ch == 13 || ch == 32 || ch == '%') {  // Enter or Space — commit; % — as percent
+      if (s_jumpLen > 0 && ch == '%') {
+        goToPercent(atoi(s_jumpBuf));
+      } else if (s_jumpLen > 0) {
         int target = atoi(s_jumpBuf);
-        if (s_totalPages > 0 && s_numPageCounts > 0) {
+        if (s_totalPages > 0) {
           // Global page navigation across chunks
           if (target < 1)           target = 1;
           if (target > s_totalPages) target = s_totalPages;
-          int offset      = 0;
-          int targetChunk = s_numPageCounts - 1;
-          int localPage   = s_pageCounts[targetChunk] - 1;
-          for (int i = 0; i < s_numPageCounts; i++) {
-            if (offset + s_pageCounts[i] >= target) {
-              targetChunk = i;
-              localPage   = target - offset - 1;
-              break;
-            }
-            offset += s_pageCounts[i];
-          }
-          if (targetChunk != currentChunk) {
-            currentChunk = targetChunk;
-            pageIndex    = (ulong)localPage;
-            appMode      = MODE_READING;
-            saveBookmark();
-            seamlessRestart();
-            return;
-          }
-          pageIndex   = (ulong)localPage;
-          needsRedraw = true;
+          goToGlobalPage(target - 1);
         } else {
           // Fallback: local chunk pages only
           int maxPg = getMaxPage();
@@ -941,20 +3397,90 @@ void processKB_APP() {
     return;
   }
 
+  // ── Search mode ─────────────────────────────────────────────────────────────
+  if (appMode == MODE_SEARCH) {
+    if (ch == 17) {  // SHIFT
+      KB().setKeyboardState(KB().getKeyboardState() == SHIFT ? NORMAL : SHIFT);
+      return;
+    }
+    if (ch == 18) {  // FN — digits and punctuation
+      KB().setKeyboardState(KB().getKeyboardState() == FUNC ? NORMAL : FUNC);
+      return;
+    }
+    if (ch == 13) {  // Enter — search and show the first hit from here on
+      if (s_queryLen > 0) {
+        u8g2.clearBuffer();
+        u8g2.setFont(u8g2_font_5x7_tf);
+        u8g2.drawStr(1, 9, "Searching...");
+        u8g2.sendBuffer();
+        if (runSearch() && s_hitCount > 0) {
+          goToHit(firstHitFromHere());
+          KB().setKeyboardState(NORMAL);
+          appMode = MODE_READING;
+        } else {
+          s_searchMiss = true;
+        }
+      }
+      updateOLED();
+    } else if (ch == 27) {  // ESC — cancel
+      KB().setKeyboardState(NORMAL);
+      appMode = MODE_READING;
+      updateOLED();
+    } else if (ch == 8) {  // Backspace
+      if (s_queryLen > 0) s_query[--s_queryLen] = '\0';
+      s_searchMiss = false;
+      updateOLED();
+    } else if (ch >= 32 && ch < 127 && s_queryLen < (int)Horspool::MAX_PATTERN) {
+      s_query[s_queryLen++] = ch;
+      s_query[s_queryLen]   = '\0';
+      s_searchMiss          = false;
+      updateOLED();
+    }
+    return;
+  }
+
+  // ── Table of contents ───────────────────────────────────────────────────────
+  if (appMode == MODE_TOC) {
+    if (ch == 21) {  // RIGHT — next heading
+      moveTocSel(1);
+    } else if (ch == 19) {  // LEFT — previous heading
+      moveTocSel(-1);
+    } else if (ch == 6 || ch == 12) {  // FN+RIGHT / FN+LEFT — a screen at a time
+      moveTocSel(ch == 6 ? TOC_VISIBLE : -TOC_VISIBLE);
+      KB().setKeyboardState(NORMAL);
+    } else if (ch == 18) {  // FN
+      KB().setKeyboardState(KB().getKeyboardState() == FUNC ? NORMAL : FUNC);
+    } else if (ch == 32 || ch == 13) {  // Space or Enter — jump to the heading
+      goToTocEntry(s_tocSel);
+      updateOLED();
+    } else if (ch == 27 || ch == 't' || ch == 'T') {  // ESC — back to the page
+      KB().setKeyboardState(NORMAL);
+      appMode     = MODE_READING;
+      needsRedraw = true;
+      updateOLED();
+    }
+    return;
+  }
+
   // ── Reading mode ────────────────────────────────────────────────────────────
+  // Leaving works even while a chunk switch waits on the index task
   if (ch == 27 || ch == 65) {  // ESC or A — save & return to OS (keeps .current)
+    stopIndexing();
     saveBookmark();
     rebootToPocketMage();
     return;
   }
 
   if (ch == 'b' || ch == 'B') {  // bookmark and return to picker
+    stopIndexing();
     saveBookmark();
     clearCurrentBook();
     seamlessRestart();
     return;
   }
 
+  if (s_pendingChunk >= 0) return;  // chunk switch still loading on the e-ink task
+
   if (ch == 'g' || ch == 'G') {  // jump to page
     s_jumpLen    = 0;
     s_jumpBuf[0] = '\0';
@@ -963,6 +3489,45 @@ void processKB_APP() {
     return;
   }
 
+  if (ch == 't' || ch == 'T') {  // table of contents, once indexing has finished
+    if (s_tocCount > 0) {
+      openToc();
+      updateOLED();
+    }
+    return;
+  }
+
+  if (ch == 's' || ch == 'S') {  // find text; the last query is kept for editing
+    s_searchMiss = false;
+    appMode      = MODE_SEARCH;
+    KB().setKeyboardState(NORMAL);
+    updateOLED();
+    return;
+  }
+
+  if (ch == 'r' || ch == 'R') {  // page cache on / off
+    s_rasterOn = !s_rasterOn;
+    saveRasterMode();
+    startRaster();
+    u8g2.clearBuffer();
+    u8g2.setFont(u8g2_font_5x7_tf);
+    u8g2.drawStr(1, 9, s_rasterOn ? "Page cache on" : "Page cache off");
+    u8g2.sendBuffer();
+    return;
+  }
+
+  if (ch == 'n' || ch == 'N') {  // next / previous search hit
+    if (s_hitCount > 0) {
+      int i = (s_hitSel < 0) ? firstHitFromHere()
+            : (ch == 'n')    ? (s_hitSel + 1) % s_hitCount
+                             : (s_hitSel + s_hitCount - 1) % s_hitCount;
+      goToHit(i);
+      updateOLED();
+    }
+    KB().setKeyboardState(NORMAL);
+    return;
+  }
+
   if (ch == 17) {  // SHIFT
     KB().setKeyboardState(KB().getKeyboardState() == SHIFT ? NORMAL : SHIFT);
     return;
@@ -973,14 +3538,11 @@ void processKB_APP() {
   }
 
   if (ch == 21) {  // RIGHT — next page
-    if ((int)pageIndex < getMaxPage()) {
+    if ((int)pageIndex < chunkMaxPage(currentChunk)) {
       pageIndex++;
       needsRedraw = true;
-    } else if (currentChunk + 1 < (int)chunks.size()) {
-      currentChunk++;
-      pageIndex = 0;
-      saveBookmark();
-      seamlessRestart();
+    } else if (hasChunk(currentChunk + 1)) {
+      requestChunk(currentChunk + 1, 0);
     }
 
   } else if (ch == 19) {  // LEFT — prev page
@@ -988,36 +3550,39 @@ void processKB_APP() {
       pageIndex--;
       needsRedraw = true;
     } else if (currentChunk > 0) {
-      currentChunk--;
-      pageIndex = 65535;  // sentinel: APP_INIT clamps to getMaxPage()
-      saveBookmark();
-      seamlessRestart();
+      requestChunk(currentChunk - 1, LAST_PAGE);
     }
 
   } else if (ch == 6) {  // RIGHT (FN) — next chunk
-    if (currentChunk + 1 < (int)chunks.size()) {
-      currentChunk++;
-      pageIndex = 0;
-      saveBookmark();
-      seamlessRestart();
+    if (hasChunk(currentChunk + 1)) {
+      requestChunk(currentChunk + 1, 0);
     }
     KB().setKeyboardState(NORMAL);
 
   } else if (ch == 12) {  // LEFT (FN) — prev chunk
     if (currentChunk > 0) {
-      currentChunk--;
-      pageIndex = 65535;
-      saveBookmark();
-      seamlessRestart();
+      requestChunk(currentChunk - 1, LAST_PAGE);
     }
     KB().setKeyboardState(NORMAL);
 
+  } else if (ch == 30) {  // RIGHT (SHIFT) — next heading
+    goToNextHeading();
+    KB().setKeyboardState(NORMAL);
+
+  } else if (ch == 28) {  // LEFT (SHIFT) — start of this heading, or the previous one
+    goToPrevHeading();
+    KB().setKeyboardState(NORMAL);
+
   } else if (KB().getKeyboardState() == FUNC || KB().getKeyboardState() == FN_SHIFT) {
     KB().setKeyboardState(NORMAL);
   }
 }
 
 void einkHandler_APP() {
+  if (s_oledDirty && appMode == MODE_READING) {
+    s_oledDirty = false;
+    updateOLED();
+  }
   if (!needsRedraw) return;
   needsRedraw = false;
 
@@ -1073,25 +3638,56 @@ void einkHandler_APP() {
     return;
   }
 
+  if (appMode == MODE_TOC) {
+    renderToc();
+    EINK().refresh();
+    updateOLED();
+    return;
+  }
+
   // ── Reading mode render ──────────────────────────────────────────────────────
-  if (fileError || chunks.empty() || currentChunk >= (int)chunks.size()) {
+  if (indexError || memError) {
     display.setFont(&FreeSerif9pt7b);
     display.setCursor(10, 30);
-    display.print(fileError ? "Cannot open book file" : "No content found");
+    display.print(memError ? "Not enough memory to read" : "Cannot write book index");
     EINK().refresh();
+    updateOLED();
     return;
   }
 
-  display.setFont(&Font5x7Fixed);
-  String header = chunks[currentChunk].heading;
-  if (header.length() == 0) header = String(s_bookDisplayName);
-  if ((int)header.length() > 44) header = header.substring(0, 43) + "~";
-  display.setCursor(4, 11);
-  display.print(header);
-  display.drawFastHLine(0, 14, display.width(), GxEPD_BLACK);
+  if (!resolveView()) {
+    // The index task sets needsRedraw once it has scanned this far
+    u8g2.clearBuffer();
+    u8g2.setFont(u8g2_font_5x7_tf);
+    u8g2.drawStr(1, 9, "Indexing...");
+    u8g2.sendBuffer();
+    return;
+  }
 
-  renderDocument(4, CONTENT_START_Y);
+  if (fileError || currentChunk >= chunkCount()) {
+    display.setFont(&FreeSerif9pt7b);
+    display.setCursor(10, 30);
+    display.print(fileError ? "Cannot open book file" : "No content found");
+    EINK().refresh();
+    return;
+  }
+
+  // Through a raster when the page is numbered: drawn into it on a miss
+  int  page  = s_viewPage;
+  bool fresh = page >= 0 && !loadRaster(page);
+  if (fresh) {
+    s_raster->fillScreen(GxEPD_WHITE);
+    renderPage(*s_raster, *s_cur, s_pageStartLine, currentChunk);
+    s_rasterPage = page;
+    ringPut(page, s_raster->getBuffer());
+  }
+  if (page >= 0)
+    showRaster();
+  else
+    renderPage(display, *s_cur, s_pageStartLine, s_markPreview ? -1 : currentChunk);
 
   EINK().refresh();
+  if (fresh) writeRaster(page, s_raster->getBuffer());
   updateOLED();
+  kickRaster(page);
 }
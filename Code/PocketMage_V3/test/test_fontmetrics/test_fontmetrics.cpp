@@ -0,0 +1,90 @@
+// FontMetrics (include/book_fontmetrics.h) tests against a port of
+// Adafruit_GFX::getTextBounds().
+// Run with: pio test -e native -f test_fontmetrics
+#include <gtest/gtest.h>
+
+#include <book_fontmetrics.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+// Printable ASCII with serif-like metrics: ascenders, descenders, and a
+// space that advances without drawing.
+static GFXglyph s_glyphs[95];
+static GFXfont  s_font = {nullptr, s_glyphs, 0x20, 0x7E, 22};
+
+static void initFont() {
+  std::mt19937 rng(3);
+  for (int c = 0x20; c <= 0x7E; c++) {
+    GFXglyph& g = s_glyphs[c - 0x20];
+    g.width     = (uint8_t)(3 + rng() % 9);
+    g.height    = (uint8_t)(4 + rng() % 9);
+    g.xOffset   = (int8_t)(rng() % 2);
+    g.yOffset   = (int8_t)(-(int)g.height + (c == 'g' || c == 'p' || c == 'y' ? 4 : 0));
+    g.xAdvance  = (uint8_t)(g.width + 1 + rng() % 2);
+  }
+  s_glyphs[0] = {0, 0, 0, 5, 0, 1};  // ' '
+}
+
+// Adafruit_GFX::getTextBounds() for one line at (0, 0), text size 1.
+static void gfxBounds(const GFXfont* font, const char* s, int& w, int& h) {
+  int x = 0, minx = 0x7FFF, miny = 0x7FFF, maxx = -1, maxy = -1;
+  for (; *s; s++) {
+    uint8_t c = (uint8_t)*s;
+    if (c < font->first || c > font->last) continue;
+    const GFXglyph& g = font->glyph[c - font->first];
+    if (g.width > 0 && g.height > 0) {
+      int x1 = x + g.xOffset, y1 = g.yOffset;
+      minx = std::min(minx, x1);
+      miny = std::min(miny, y1);
+      maxx = std::max(maxx, x1 + g.width - 1);
+      maxy = std::max(maxy, y1 + g.height - 1);
+    }
+    x += g.xAdvance;
+  }
+  w = maxx >= minx ? maxx - minx + 1 : 0;
+  h = maxy >= miny ? maxy - miny + 1 : 0;
+}
+
+TEST(fontmetrics, AdvanceSumsGlyphs) {
+  initFont();
+  FontMetrics fm(&s_font);
+  EXPECT_EQ(0, fm.advance(""));
+  EXPECT_EQ(s_glyphs['a' - 0x20].xAdvance + s_glyphs['b' - 0x20].xAdvance, fm.advance("ab"));
+  EXPECT_EQ(fm.advance("ab") + fm.advance("cd"), fm.advance("abcd"));
+  EXPECT_EQ(5, fm.advance(" "));
+  EXPECT_EQ(fm.advance("abc"), fm.advance("abcdef", 3));
+  EXPECT_EQ(22, fm.lineHeight());
+}
+
+TEST(fontmetrics, SkipsCharactersNotInFont) {
+  initFont();
+  FontMetrics fm(&s_font);
+  EXPECT_EQ(fm.advance("ab"), fm.advance("a\x7F\xC3\xA9" "b"));
+  EXPECT_EQ(0, fm.height("\x01\x02"));
+  FontMetrics none(nullptr);
+  EXPECT_EQ(0, none.advance("abc"));
+  EXPECT_EQ(0, none.lineHeight());
+}
+
+TEST(fontmetrics, HeightMatchesGetTextBounds) {
+  initFont();
+  FontMetrics fm(&s_font);
+  for (const char* s : {"a", "ag", "gyp", "Hello,", "  ", "x y", "typography", "**"}) {
+    int w, h;
+    gfxBounds(&s_font, s, w, h);
+    EXPECT_EQ(h, fm.height(s)) << s;
+    int mw, mh;
+    fm.measure(s, strlen(s), mw, mh);
+    EXPECT_EQ(fm.advance(s), mw) << s;
+    EXPECT_EQ(h, mh) << s;
+  }
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  if (RUN_ALL_TESTS());
+  // Always return zero-code and allow PlatformIO to parse results
+  return 0;
+}
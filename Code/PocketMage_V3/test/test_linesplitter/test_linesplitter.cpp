@@ -0,0 +1,191 @@
+// LineSplitter (include/book_linesplitter.h) tests and a lines/sec comparison
+// against the readStringUntil()/trim()/substring() path it replaced.
+// Run with: pio test -e native -f test_linesplitter
+#include <gtest/gtest.h>
+
+#include <book_linesplitter.h>
+
+#include <chrono>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+typedef std::vector<std::pair<size_t, std::string>> Lines;
+
+// Every line the splitter gives for data[start, end), as (book offset, text)
+static Lines split(const std::string& data, size_t start, size_t end, size_t cap, bool whole) {
+  LineSplitter lines(data.data() + start, end - start, cap, whole);
+  Lines        out;
+  size_t       off, n;
+  while (lines.next(off, n)) out.push_back({start + off, std::string(data.data() + start + off, n)});
+  return out;
+}
+
+// ── Reference: the old per-line String path ──────────────────────────────────
+static std::string readStringUntil(const std::string& s, size_t& pos, char term) {
+  std::string ret;
+  while (pos < s.size() && s[pos] != term) ret += s[pos++];
+  if (pos < s.size()) pos++;
+  return ret;
+}
+
+static void trim(std::string& s) {
+  size_t b = 0, e = s.size();
+  while (b < e && isspace((unsigned char)s[b])) b++;
+  while (e > b && isspace((unsigned char)s[e - 1])) e--;
+  s = s.substr(b, e - b);
+}
+
+static std::vector<std::string> readAllOld(const std::string& s) {
+  std::vector<std::string> lines;
+  size_t pos = 0;
+  while (pos < s.size()) {
+    std::string raw = readStringUntil(s, pos, '\n');
+    trim(raw);
+    std::string content = raw.compare(0, 2, "# ") == 0 ? raw.substr(2) : std::move(raw);
+    lines.push_back(content);
+  }
+  return lines;
+}
+
+// ── New path, as the reader app uses it ──────────────────────────────────────
+static void trimmed(const char*& line, size_t& len) {
+  while (len > 0 && isspace((unsigned char)*line)) {
+    line++;
+    len--;
+  }
+  while (len > 0 && isspace((unsigned char)line[len - 1])) len--;
+}
+
+static std::vector<std::string> readAllNew(const std::string& s, size_t cap) {
+  LineSplitter             lines(s.data(), s.size(), cap, true);
+  std::vector<std::string> out;
+  size_t off, len;
+  while (lines.next(off, len)) {
+    const char* line = s.data() + off;
+    trimmed(line, len);
+    const char* content = (len >= 2 && line[0] == '#' && line[1] == ' ') ? line + 2 : line;
+    out.push_back(std::string(content, len - (content - line)));
+  }
+  return out;
+}
+
+// About 2 MB of Markdown shaped like a converted novel
+static std::string makeBook() {
+  std::string book;
+  const std::string para =
+      "It was a bright cold day in April, and the clocks were striking thirteen. "
+      "Winston Smith, his chin nuzzled into his breast in an effort to escape the vile "
+      "wind, slipped quickly through the glass doors of Victory Mansions, though not "
+      "quickly enough to prevent a swirl of gritty dust from entering along with him.";
+  for (int ch = 0; book.size() < 2 * 1024 * 1024; ch++) {
+    book += "# Chapter " + std::to_string(ch) + "\n\n";
+    for (int p = 0; p < 40; p++) {
+      book += (p % 7 == 0) ? "  " + para + "  \r\n" : para + "\n";
+      book += "\n";
+    }
+    book += "---\n";
+  }
+  return book;
+}
+
+TEST(linesplitter, MatchesStringPath) {
+  std::string book = makeBook();
+  EXPECT_EQ(readAllOld(book), readAllNew(book, 8192));
+}
+
+TEST(linesplitter, OffsetsAndLastLine) {
+  std::string data = "one\r\ntwo\n\nthree";
+  Lines       expect = {{0, "one"}, {5, "two"}, {9, ""}, {10, "three"}};
+  EXPECT_EQ(expect, split(data, 0, data.size(), 16, true));
+
+  // Not known to end there: the unterminated last line is held back
+  LineSplitter lines(data.data(), data.size(), 16, false);
+  size_t       off, n, count = 0;
+  while (lines.next(off, n)) count++;
+  EXPECT_EQ(3u, count);
+  EXPECT_EQ(10u, lines.position());
+
+  EXPECT_EQ(Lines({{5, "two"}, {9, ""}, {10, "three"}}), split(data, 5, data.size(), 16, true));
+}
+
+TEST(linesplitter, SplitsLongLinesWithoutLoss) {
+  std::string data   = std::string(40, 'x') + "\nend\n";
+  Lines       expect = {{0, std::string(15, 'x')}, {15, std::string(15, 'x')},
+                        {30, std::string(10, 'x')}, {41, "end"}};
+  EXPECT_EQ(expect, split(data, 0, data.size(), 16, true));
+}
+
+TEST(linesplitter, CutsDoNotDependOnWhereTheBufferEnds) {
+  // Long lines, CRLF, blank lines and no final newline, split from several
+  // starting offsets and with the buffer ending at every possible place:
+  // every line given is one of those the whole stretch gives
+  std::string data;
+  for (int i = 0; i < 30; i++) data += std::string(i * 3 % 41, 'a' + i % 26) + (i % 4 ? "\n" : "\r\n");
+  data += "tail";
+  const size_t cap = 16;
+  for (size_t start : {(size_t)0, (size_t)7, (size_t)60}) {
+    Lines expect = split(data, start, data.size(), cap, true);
+    for (const auto& line : expect) EXPECT_LE(line.second.size(), cap - 1);
+
+    for (size_t end = start; end <= data.size(); end++) {
+      bool         whole = end == data.size();
+      LineSplitter lines(data.data() + start, end - start, cap, whole);
+      size_t       off, n, i = 0;
+      while (lines.next(off, n)) {
+        ASSERT_LT(i, expect.size());
+        EXPECT_EQ(expect[i].first, start + off);
+        EXPECT_EQ(expect[i].second, std::string(data.data() + start + off, n));
+        i++;
+      }
+      // Held back only what could still be cut differently
+      if (whole) {
+        EXPECT_EQ(expect.size(), i);
+      }
+      EXPECT_LE(end - (start + lines.position()), cap - 1) << start << " " << end;
+    }
+  }
+}
+
+TEST(linesplitter, Benchmark) {
+  using Clock = std::chrono::steady_clock;
+  std::string book = makeBook();
+
+  // Both paths only tally lines and content bytes, as the app lays each
+  // line out straight away
+  size_t oldLines = 0, oldBytes = 0, pos = 0;
+  auto   t0       = Clock::now();
+  while (pos < book.size()) {
+    std::string raw = readStringUntil(book, pos, '\n');
+    trim(raw);
+    std::string content = raw.compare(0, 2, "# ") == 0 ? raw.substr(2) : std::move(raw);
+    oldLines++;
+    oldBytes += content.size();
+  }
+  auto t1 = Clock::now();
+
+  LineSplitter lines(book.data(), book.size(), 8192, true);
+  size_t       n = 0, bytes = 0, off, len;
+  while (lines.next(off, len)) {
+    const char* line = book.data() + off;
+    trimmed(line, len);
+    n++;
+    bytes += (len >= 2 && line[0] == '#' && line[1] == ' ') ? len - 2 : len;
+  }
+  auto t2 = Clock::now();
+
+  ASSERT_EQ(oldLines, n);
+  ASSERT_EQ(oldBytes, bytes);
+  double oldSec = std::chrono::duration<double>(t1 - t0).count();
+  double newSec = std::chrono::duration<double>(t2 - t1).count();
+  printf("[ bench    ] %zu lines, %.1f KB\n", n, book.size() / 1024.0);
+  printf("[ bench    ] readStringUntil/trim/substring: %.0f lines/sec\n", n / oldSec);
+  printf("[ bench    ] LineSplitter (8 KB lines):      %.0f lines/sec\n", n / newSec);
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  if (RUN_ALL_TESTS());
+  // Always return zero-code and allow PlatformIO to parse results
+  return 0;
+}
@@ -0,0 +1,60 @@
+// Inline Markdown tokenizer (include/book_markdown.h) tests.
+// Run with: pio test -e native -f test_markdown
+#include <gtest/gtest.h>
+
+#include <book_markdown.h>
+
+#include <string.h>
+#include <string>
+#include <vector>
+
+// Runs as "text" with b/i/c prefixes for the flags, e.g. "b:bold".
+static std::vector<std::string> runs(const char* text) {
+  std::vector<std::string> out;
+  forEachRun(text, strlen(text), [&](const char* run, size_t len, uint8_t flags) {
+    std::string r;
+    if (flags & RUN_BOLD) r += 'b';
+    if (flags & RUN_ITALIC) r += 'i';
+    if (flags & RUN_CODE) r += 'c';
+    out.push_back(r + ":" + std::string(run, len));
+  });
+  return out;
+}
+
+using Runs = std::vector<std::string>;
+
+TEST(markdown, PlainAndEmphasis) {
+  EXPECT_EQ((Runs{":plain text"}), runs("plain text"));
+  EXPECT_EQ((Runs{":a ", "b:bold", ": and ", "i:it"}), runs("a **bold** and *it*"));
+  EXPECT_EQ((Runs{"b:open to the end"}), runs("**open to the end"));
+  EXPECT_TRUE(runs("").empty());
+  EXPECT_EQ((Runs{":**** rule"}), runs("**** rule"));
+}
+
+TEST(markdown, NestedEmphasis) {
+  EXPECT_EQ((Runs{"bi:both"}), runs("***both***"));
+  EXPECT_EQ((Runs{"bi:a", "i: b"}), runs("***a** b*"));
+  EXPECT_EQ((Runs{"b:a ", "bi:b"}), runs("**a *b***"));
+  EXPECT_EQ((Runs{"b:x ", "bi:y", "b: z"}), runs("**x *y* z**"));
+}
+
+TEST(markdown, InlineCode) {
+  EXPECT_EQ((Runs{":run ", "c:a*b**c", ": now"}), runs("run `a*b**c` now"));
+  EXPECT_EQ((Runs{"b:in ", "bc:code", "b: ok"}), runs("**in `code` ok**"));
+  EXPECT_EQ((Runs{"c:no end \\*"}), runs("`no end \\*"));
+}
+
+TEST(markdown, Escapes) {
+  EXPECT_EQ((Runs{":5 ", ":* 3"}), runs("5 \\* 3"));
+  EXPECT_EQ((Runs{":a", ":*", "i:b"}), runs("a\\**b"));  // one literal *, one marker
+  EXPECT_EQ((Runs{":`x"}), runs("\\`x"));
+  EXPECT_EQ((Runs{":path\\to"}), runs("path\\to"));  // not before punctuation
+  EXPECT_EQ((Runs{":end\\"}), runs("end\\"));
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  if (RUN_ALL_TESTS());
+  // Always return zero-code and allow PlatformIO to parse results
+  return 0;
+}
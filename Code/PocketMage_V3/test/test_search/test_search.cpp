@@ -0,0 +1,186 @@
+// Horspool (include/book_search.h) tests, and finding the page that shows a
+// match.
+// Run with: pio test -e native -f test_search
+#include <gtest/gtest.h>
+
+#include <book_search.h>
+
+#include <algorithm>
+#include <ctype.h>
+#include <string>
+#include <vector>
+
+// In-memory stand-in for fs::File.
+class MemStream {
+public:
+  explicit MemStream(const std::string& data) : data_(data) {}
+
+  size_t read(uint8_t* buf, size_t size) {
+    size_t n = std::min(size, data_.size() - pos_);
+    memcpy(buf, data_.data() + pos_, n);
+    pos_ += n;
+    return n;
+  }
+  bool seek(uint32_t pos) {
+    if (pos > data_.size()) return false;
+    pos_ = pos;
+    return true;
+  }
+
+private:
+  const std::string& data_;
+  size_t             pos_ = 0;
+};
+
+// Non-overlapping, ASCII case-insensitive matches, the slow way.
+static std::vector<uint32_t> naive(const std::string& text, const std::string& pat) {
+  std::vector<uint32_t> hits;
+  auto eq = [](char a, char b) { return tolower((unsigned char)a) == tolower((unsigned char)b); };
+  auto it = text.begin();
+  while ((it = std::search(it, text.end(), pat.begin(), pat.end(), eq)) != text.end()) {
+    hits.push_back((uint32_t)(it - text.begin()));
+    it += pat.size();
+  }
+  return hits;
+}
+
+static std::vector<uint32_t> scanAll(const std::string& text, const std::string& pat,
+                                     size_t cap, uint32_t start = 0, uint32_t end = UINT32_MAX) {
+  Horspool h;
+  EXPECT_TRUE(h.setPattern(pat.data(), pat.size()));
+  MemStream             s(text);
+  std::vector<char>     buf(cap);
+  std::vector<uint32_t> hits(100000);
+  int n = h.scan(s, start, end, buf.data(), cap, hits.data(), (int)hits.size());
+  hits.resize(std::min(n, (int)hits.size()));
+  return hits;
+}
+
+static std::string makeBook() {
+  std::string book;
+  const std::string para =
+      "It was a bright cold day in April, and the clocks were striking thirteen. "
+      "Winston Smith, his chin nuzzled into his breast in an effort to escape the vile "
+      "wind, slipped quickly through the glass doors of Victory Mansions.\n\n";
+  for (int ch = 0; book.size() < 300000; ch++) {
+    book += "# Chapter " + std::to_string(ch) + "\n\n";
+    for (int p = 0; p < 40; p++) book += para;
+  }
+  return book;
+}
+
+TEST(search, MatchesNaive) {
+  std::string book = makeBook();
+  for (const char* pat : {"thirteen", "VICTORY mansions", "e", "chapter 1", "zzz"})
+    EXPECT_EQ(naive(book, pat), scanAll(book, pat, 4096)) << pat;
+}
+
+TEST(search, FindsMatchesAcrossReads) {
+  // Every possible split of the match between two reads
+  std::string text = std::string(40, '.') + "Needle" + std::string(40, '.');
+  for (size_t cap = 7; cap < 50; cap++) {
+    std::vector<uint32_t> hits = scanAll(text, "needle", cap);
+    ASSERT_EQ(1u, hits.size()) << cap;
+    EXPECT_EQ(40u, hits[0]);
+  }
+}
+
+TEST(search, NonOverlappingAndFromOffset) {
+  EXPECT_EQ((std::vector<uint32_t>{0, 2}), scanAll("aaaaa", "aa", 16));
+  EXPECT_EQ((std::vector<uint32_t>{3, 5}), scanAll("aaaaaaa", "aa", 16, 3));
+}
+
+TEST(search, RangeKeepsMatchesThatRunPastEnd) {
+  std::string text = "xx needle xx needle xx";
+  EXPECT_EQ((std::vector<uint32_t>{3}), scanAll(text, "needle", 8, 0, 4));
+  EXPECT_EQ((std::vector<uint32_t>{13}), scanAll(text, "needle", 8, 4, 14));
+  EXPECT_EQ((std::vector<uint32_t>{}), scanAll(text, "needle", 8, 4, 13));
+}
+
+TEST(search, WordStartSkipsMatchesInsideWords) {
+  std::string text = "cat concatenate, cats (cat) bobcat\ncat";
+  for (size_t cap = 4; cap < 48; cap++) {
+    Horspool h;
+    h.setPattern("cat", 3);
+    h.setWordStart(true);
+    MemStream s(text);
+    std::vector<char> buf(cap);
+    uint32_t hits[8];
+    int      n = h.scan(s, 0, UINT32_MAX, buf.data(), cap, hits, 8);
+    ASSERT_EQ(4, n) << cap;
+    EXPECT_EQ((std::vector<uint32_t>{0, 17, 23, 35}), std::vector<uint32_t>(hits, hits + 4));
+
+    // From inside a word the byte before the range still counts
+    MemStream t(text);
+    EXPECT_EQ(0, h.scan(t, 7, 10, buf.data(), cap, hits, 8)) << cap;
+  }
+}
+
+TEST(search, RejectsBadPatterns) {
+  Horspool h;
+  EXPECT_FALSE(h.setPattern("", 0));
+  EXPECT_FALSE(h.setPattern(std::string(Horspool::MAX_PATTERN + 1, 'x').c_str(),
+                            Horspool::MAX_PATTERN + 1));
+}
+
+// A paragraph wrapped into lines of `perLine` words and cut into pages of
+// `perPage` lines, after a one-line heading, like the reader's page table:
+// each page keeps the source line it starts in and its first word's offset.
+struct ModelPage {
+  uint32_t line;
+  uint32_t firstByte;
+  int      skip;
+};
+
+static std::vector<ModelPage> modelPages(const std::string& book, int perLine, int perPage) {
+  std::vector<ModelPage> pages;
+  uint32_t               line = 0;
+  int                    shown = 0;  // display lines on the page being filled
+  while (line < book.size()) {
+    size_t end = book.find('\n', line);
+    if (end == std::string::npos) end = book.size();
+    int      words = 0, skip = 0;
+    uint32_t pos   = line;
+    while (pos < end) {
+      if (words % perLine == 0) {
+        if (shown % perPage == 0) pages.push_back({line, pos, skip});
+        shown++;
+        skip++;
+      }
+      words++;
+      pos = (uint32_t)std::min(book.find(' ', pos), end) + 1;
+    }
+    line = (uint32_t)end + 1;
+  }
+  return pages;
+}
+
+TEST(search, HitOnFirstPageOfParagraph) {
+  std::string para;
+  for (int i = 0; i < 30; i++) para += (i == 4 ? "needle" : "word") + std::string(i < 29 ? " " : "");
+  std::string book  = "Heading\n" + para + "\n";
+  auto        pages = modelPages(book, 3, 6);  // the paragraph runs onto page 1
+  ASSERT_EQ(2u, pages.size());
+  ASSERT_EQ(pages[0].line, 0u);
+  ASSERT_EQ(pages[1].line, 8u);
+  ASSERT_GT(pages[1].skip, 0);
+
+  uint32_t at = scanAll(book, "needle", 64)[0];
+  // The last page starting at or before the hit's line: too late
+  int page = 0;
+  while (page + 1 < (int)pages.size() && pages[page + 1].line <= at) page++;
+  EXPECT_EQ(1, page);
+
+  auto inLine    = [&](int p) { return pages[p].line == 8 && pages[p].skip > 0; };
+  auto firstByte = [&](int p) { return pages[p].firstByte; };
+  EXPECT_EQ(0, pageShowing(at, page, inLine, firstByte));
+  uint32_t later = (uint32_t)book.rfind("word");
+  EXPECT_EQ(1, pageShowing(later, page, inLine, firstByte));
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  if (RUN_ALL_TESTS());
+  // Always return zero-code and allow PlatformIO to parse results
+  return 0;
+}
@@ -0,0 +1,197 @@
+// Word index (include/book_wordindex.h) tests: tokenizing, narrowing a search
+// to the chunks that can hold it, and a .wix written a few bucket ranges at a
+// time, as the reader builds it, read back word by word against a
+// brute-force map.
+// Run with: pio test -e native -f test_wordindex
+#include <gtest/gtest.h>
+
+#include <book_search.h>
+#include <book_wordindex.h>
+
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+// In-memory stand-in for fs::File, readable and writable.
+class MemFile {
+public:
+  size_t write(const uint8_t* buf, size_t size) {
+    if (pos_ + size > data_.size()) data_.resize(pos_ + size);
+    memcpy(&data_[pos_], buf, size);
+    pos_ += size;
+    return size;
+  }
+  size_t read(uint8_t* buf, size_t size) {
+    size_t n = std::min(size, data_.size() - pos_);
+    memcpy(buf, data_.data() + pos_, n);
+    pos_ += n;
+    return n;
+  }
+  bool seek(uint32_t pos) {
+    if (pos > data_.size()) return false;
+    pos_ = pos;
+    return true;
+  }
+  size_t size() const { return data_.size(); }
+
+private:
+  std::string data_;
+  size_t      pos_ = 0;
+};
+
+static std::vector<uint32_t> words(const char* text) {
+  std::vector<uint32_t> out;
+  forEachWord(text, strlen(text), [&](uint32_t h) { out.push_back(h); });
+  return out;
+}
+
+TEST(wordindex, Tokenizes) {
+  EXPECT_EQ(words("the cat"), words("  **The** CAT!  "));
+  EXPECT_EQ(4u, words("don't stop-now").size());  // don, t, stop, now
+  EXPECT_EQ(1u, words("caf\xc3\xa9").size());
+  EXPECT_TRUE(words("*** -- ...").empty());
+  EXPECT_NE(wordHash("cat", 3), wordHash("cats", 4));
+}
+
+static std::vector<uint32_t> queryTerms(const char* query) {
+  std::vector<uint32_t> out;
+  forEachQueryTerm(query, strlen(query), [&](uint32_t h) { out.push_back(h); });
+  return out;
+}
+
+static std::vector<uint32_t> indexTerms(const char* text) {
+  std::vector<uint32_t> out;
+  forEachIndexTerm(text, strlen(text), [&](uint32_t h) { out.push_back(h); });
+  return out;
+}
+
+TEST(wordindex, QueryTerms) {
+  // A last word that runs to the end narrows by its start
+  EXPECT_EQ(std::vector<uint32_t>{prefixHash("cat")}, queryTerms("cat"));
+  EXPECT_EQ(std::vector<uint32_t>{prefixHash("cat")}, queryTerms("Category"));
+  EXPECT_EQ((std::vector<uint32_t>{wordHash("the", 3), prefixHash("cat")}), queryTerms("the cat"));
+  EXPECT_EQ(words("the cat sat"), queryTerms("the cat sat "));
+  EXPECT_EQ(words("cat"), queryTerms(" cat "));
+  EXPECT_TRUE(queryTerms("ca").empty());
+  EXPECT_EQ(words("to"), queryTerms("to be"));
+  EXPECT_NE(wordHash("cat", 3), prefixHash("cat"));
+
+  EXPECT_EQ((std::vector<uint32_t>{wordHash("cats", 4), prefixHash("cat"), wordHash("a", 1)}),
+            indexTerms("cats, a"));
+}
+
+// Matches of query in chunks (joined with '\n'), taken at word starts when
+// the query begins with a word byte, as the reader does. With `narrow`, only
+// the chunks holding all its query terms are read; `read` counts them.
+static int hitsIn(const std::vector<std::string>& chunks, const char* query, bool narrow,
+                  int* read = nullptr) {
+  std::vector<uint32_t> need = narrow ? queryTerms(query) : std::vector<uint32_t>();
+  std::string           text;
+  std::vector<uint32_t> starts;
+  for (const std::string& c : chunks) {
+    starts.push_back((uint32_t)text.size());
+    text += c + "\n";
+  }
+  Horspool m;
+  m.setPattern(query, strlen(query));
+  m.setWordStart(queryStartsWord(query, strlen(query)));
+  MemFile f;
+  f.write((const uint8_t*)text.data(), text.size());
+  char buf[64];
+  int  hits = 0;
+  if (read) *read = 0;
+  for (size_t i = 0; i < chunks.size(); i++) {
+    std::vector<uint32_t> has = indexTerms(chunks[i].c_str());
+    bool                  all = true;
+    for (uint32_t h : need) all = all && std::find(has.begin(), has.end(), h) != has.end();
+    if (!all) continue;
+    if (read) (*read)++;
+    uint32_t at[16];
+    hits += m.scan(f, starts[i], starts[i] + (uint32_t)chunks[i].size() + 1, buf, sizeof(buf), at,
+                   16);
+  }
+  return hits;
+}
+
+TEST(wordindex, NarrowingKeepsWordStartMatches) {
+  // "cat" as a word in one chunk, starting a longer word in another, only
+  // inside words in a third
+  std::vector<std::string> chunks = {"the cat sat", "cats catalog", "concatenate bobcat",
+                                     "a dog"};
+  int read;
+  EXPECT_EQ(3, hitsIn(chunks, "cat", true, &read));
+  EXPECT_EQ(2, read);  // a one-word search reads only the chunks with words starting "cat"
+  EXPECT_EQ(1, hitsIn(chunks, "the cat", true, &read));
+  EXPECT_EQ(1, read);
+  for (const char* q : {"cat", " cat ", "at", "e cat s", "s cat", " dog cat ", "a dog", "cat."})
+    EXPECT_EQ(hitsIn(chunks, q, false), hitsIn(chunks, q, true)) << q;
+}
+
+TEST(wordindex, WordSetKeepsDistinct) {
+  uint32_t slots[64];
+  WordSet  set(slots, 64);
+  for (uint32_t h : words("a b a c b a")) set.insert(h);
+  EXPECT_EQ(3u, set.size());
+  set.clear();
+  EXPECT_EQ(0u, set.size());
+}
+
+TEST(wordindex, RoundTrip) {
+  // Random word/chunk occurrences, with repeats, in chunk order like the log
+  std::mt19937                       rng(7);
+  std::map<uint32_t, std::set<uint32_t>> expect;
+  std::vector<WordPair>              log;
+  for (uint32_t chunk = 0; chunk < 3000; chunk++) {
+    for (int i = 0; i < 40; i++) {
+      uint32_t word = rng() % 5000;
+      uint32_t h    = wordHash((const char*)&word, sizeof(word));
+      if (i == 0) h = wordHash("the", 3);  // one word in every chunk
+      log.push_back({h, chunk});
+      expect[h].insert(chunk);
+    }
+  }
+
+  MemFile   f;
+  WixHeader hdr = {};
+  WixBucket dir[WIX_BUCKETS];
+  f.write((const uint8_t*)&hdr, sizeof(hdr));
+  f.write((const uint8_t*)dir, sizeof(dir));
+
+  // Four passes over the log, one range of buckets each
+  uint32_t off = sizeof(hdr) + sizeof(dir);
+  for (int pass = 0; pass < 4; pass++) {
+    int lo = pass * WIX_BUCKETS / 4, hi = (pass + 1) * WIX_BUCKETS / 4;
+    std::vector<WordPair> part;
+    for (const WordPair& p : log)
+      if (wixBucket(p.hash) >= lo && wixBucket(p.hash) < hi) part.push_back(p);
+    size_t n = sortWordPairs(part.data(), part.size());
+    uint32_t wrote = wixWriteBuckets(f, part.data(), n, off, lo, hi, dir);
+    ASSERT_TRUE(n == 0 || wrote > 0);
+    off += wrote;
+  }
+  ASSERT_EQ(off, f.size());
+  f.seek(sizeof(hdr));
+  f.write((const uint8_t*)dir, sizeof(dir));
+
+  for (const auto& kv : expect) {
+    WixEntry e;
+    ASSERT_TRUE(wixFind(f, kv.first, e));
+    ASSERT_EQ(kv.second.size(), e.postCount);
+    PostingReader<MemFile> r(f, e);
+    std::vector<uint32_t>  got;
+    uint32_t               c;
+    while (r.next(c)) got.push_back(c);
+    EXPECT_EQ(std::vector<uint32_t>(kv.second.begin(), kv.second.end()), got);
+  }
+  WixEntry e;
+  EXPECT_FALSE(wixFind(f, wordHash("zebra", 5), e));
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  if (RUN_ALL_TESTS());
+  // Always return zero-code and allow PlatformIO to parse results
+  return 0;
+}